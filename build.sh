@@ -13,7 +13,7 @@ while [[ "$#" ]]; do case $1 in
   break
   ;;
     release)
-    CFLAGS="--std=c99 -Wall -Wextra -pedantic -DDMT_STACK_TRACE -O3 -L$OUTPUT -o $BINARY"
+    CFLAGS="--std=c99 -Wall -Wextra -pedantic -DBYTE_ALLOC=alloc_raw -O3 -L$OUTPUT -o $BINARY"
     TAG="[RELEASE]"
     break
   ;;
@@ -46,8 +46,16 @@ for F in $OUTPUT/*.o
 echo "$TAG: compiling..."
 gcc $CFLAGS $SOURCE/$MAIN.c $LFLAGS
 
+echo "$TAG: compiling tools..."
+gcc -Wall -Wextra -O2 -I$SOURCE -L$OUTPUT -o $OUTPUT/replay tools/replay.c -larena -ldmt -lvec
+
+echo "$TAG: testing..."
+gcc -Wall -Wextra -I$SOURCE -L$OUTPUT -o $OUTPUT/mpc_ast tests/mpc_ast.c -lmpc -lm
+$OUTPUT/mpc_ast
+rm -rf $OUTPUT/mpc_ast
+
 echo "$TAG: stripping.."
-strip $BINARY
+strip $BINARY $OUTPUT/replay
 
 echo "$TAG: cleaning up..."
 for F in $SOURCE/*/*.c
@@ -1,8 +1,6 @@
 #ifndef OPCODE_H
 #define OPCODE_H
 
-typedef struct OP_CODE OP_CODE;
-
 typedef enum {
   OP_HLT = 0x00,
   OP_PSH = 0x01,
@@ -16,9 +14,4 @@ typedef enum {
   OP_GET = 0x09,
 } op_code;
 
-struct OP_CODE {
-  op_code value;
-  OP_CODE *next;
-};
-
 #endif
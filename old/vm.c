@@ -13,48 +13,27 @@
 byteVM* byte_new() {
   byteVM *vm = new(byteVM);
   vm->ip = 0x00;
-  vm->size = 0x00;
-  vm->head = NULL;
-  vm->tail = NULL;
+  vecd_init(&vm->code);
   return vm;
 }
 
 void byte_destroy(byteVM *vm) {
-  OP_CODE *t = byte_pop(vm);
-  while (t) {
-    printf("%i\n", t->value);
-    delete(t);
-    t = byte_pop(vm);
+  op_code op;
+  while (byte_pop(vm, &op)) {
+    printf("%i\n", op);
   }
+  vecd_deinit(&vm->code);
+  delete(vm);
 }
 
 void byte_push(byteVM *vm, int i) {
-  OP_CODE *v = new(OP_CODE);
-  v->value = i;
-  if (vm->size > 0) {
-    vm->tail->next = v;
-    vm->tail = v;
-  } else if (vm->size == 0) {
-    vm->head = v;
-    vm->tail = v;
-  }
-  vm->size++;
+  vecd_push_back(&vm->code, (op_code) i);
 }
 
-OP_CODE *byte_pop(byteVM *vm) {
-  OP_CODE *v = new(OP_CODE);
-  if (vm->size > 1) {
-    v = vm->head;
-    vm->head = vm->head->next;
-  } else if (vm->size == 1) {
-    v = vm->head;
-    vm->head = NULL;
-    vm->tail = NULL;
-  } else {
-    v = NULL;
-  }
-  vm->size--;
-  return v;
+int byte_pop(byteVM *vm, op_code *op) {
+  if (vm->code.length == 0) return 0;
+  *op = vecd_pop_front(&vm->code);
+  return 1;
 }
 
 byteVM *example;
@@ -11,6 +11,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include "opcode.h"
+#include "../src/vec/vec.h"
 
 #define UNUSED(x) ((void) x)
 #define new(T) (T*)malloc(sizeof(T))
@@ -18,16 +19,16 @@
 
 #define MAX_STACK 0xFFFF
 
+typedef vecd_t(op_code) vec_opcode_t;
+
 typedef struct {
   size_t ip;
-  size_t size;
-  OP_CODE* head;
-  OP_CODE* tail;
+  vec_opcode_t code;
 } byteVM;
 
 byteVM* byte_new();
 void byte_destroy(byteVM *vm);
 void byte_push(byteVM *vm, int i);
-OP_CODE* byte_pop(byteVM *vm);
+int byte_pop(byteVM *vm, op_code *op);
 
 #endif
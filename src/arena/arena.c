@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* every arena allocation is preceded by a header holding its size; the union
+ * keeps the returned memory aligned for any type */
+typedef union {
+  size_t size;
+  long double ld;
+  long long ll;
+  void *p;
+} ArenaHeader;
+
+#define ARENA_NO_LAST ((size_t) -1)
+#define arena_round(n) \
+  (((n) + sizeof(ArenaHeader) - 1) / sizeof(ArenaHeader) * sizeof(ArenaHeader))
+#define arena_data(b) ((char*) (b) + arena_round(sizeof(ArenaBlock)))
+
+void arena_init(Arena *A) {
+  A->blocks = NULL;
+}
+
+void arena_deinit(Arena *A) {
+  ArenaBlock *b = A->blocks, *next;
+  while (b) {
+    next = b->next;
+    free(b);
+    b = next;
+  }
+  A->blocks = NULL;
+}
+
+void *alloc_arena(void *ud, void *ptr, size_t size) {
+  Arena *A = ud;
+  ArenaBlock *b = A->blocks;
+  ArenaHeader *h;
+  size_t need = sizeof(ArenaHeader) + arena_round(size);
+  int is_last = 0;
+
+  if (ptr) {
+    h = (ArenaHeader*) ptr - 1;
+    is_last = b && b->last != ARENA_NO_LAST &&
+              (char*) h == arena_data(b) + b->last;
+    /* only the most recent allocation can be shrunk, grown or freed in
+     * place; anything else is reclaimed by arena_deinit() */
+    if (size == 0) {
+      if (is_last) {
+        b->used = b->last;
+        b->last = ARENA_NO_LAST;
+      }
+      return NULL;
+    }
+    if (is_last && b->last + need <= b->size) {
+      h->size = size;
+      b->used = b->last + need;
+      return ptr;
+    }
+  } else if (size == 0) {
+    return NULL;
+  }
+
+  /* start a new block if the current one can't fit the request */
+  if (!b || b->used + need > b->size) {
+    size_t bsize = need > ARENA_BLOCK_SIZE ? need : ARENA_BLOCK_SIZE;
+    b = malloc(arena_round(sizeof(ArenaBlock)) + bsize);
+    if (!b) return NULL;
+    b->size = bsize;
+    b->used = 0;
+    b->last = ARENA_NO_LAST;
+    b->next = A->blocks;
+    A->blocks = b;
+  }
+  h = (ArenaHeader*) (arena_data(b) + b->used);
+  h->size = size;
+  b->last = b->used;
+  b->used += need;
+
+  if (ptr) {
+    ArenaHeader *old = (ArenaHeader*) ptr - 1;
+    memcpy(h + 1, ptr, old->size < size ? old->size : size);
+  }
+  return h + 1;
+}
+
+size_t arena_reserved(Arena *A) {
+  ArenaBlock *b;
+  size_t total = 0;
+  for (b = A->blocks; b; b = b->next) total += b->size;
+  return total;
+}
@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 65536 /* min size of a block requested by an arena */
+
+typedef struct Arena Arena;
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+  ArenaBlock *next; /* previously filled block */
+  size_t size;      /* usable bytes in the block */
+  size_t used;      /* bytes handed out so far */
+  size_t last;      /* offset of the most recent allocation's header */
+};
+
+struct Arena {
+  ArenaBlock *blocks; /* current block, followed by older ones */
+};
+
+void arena_init(Arena *A);                           /* init an empty arena */
+void arena_deinit(Arena *A);                         /* free every block owned by the arena */
+size_t arena_reserved(Arena *A);                     /* bytes obtained from the system */
+void *alloc_arena(void *ud, void *ptr, size_t size); /* realloc-like bump allocation, ud is the Arena */
+
+#endif
@@ -12,18 +12,60 @@
 #include "byte.h"
 #include "util.h"
 
-static void *zrealloc(State *S, void *ptr, size_t size) {
-  if (ptr && size == 0) {
-    dmt_free(ptr);
+/* zrealloc and zfree pass their own location on, so an allocator that
+ * records callsites (alloc_dmt_site) sees where the state asked for memory */
+#define zrealloc(S, ptr, size) zrealloc_(S, ptr, size, __FILE__, __LINE__)
+#define zfree(S, ptr)          zrealloc_(S, ptr, 0, __FILE__, __LINE__)
+
+static void *state_alloc(State *S, void *ptr, size_t size,
+                         const char *file, unsigned line) {
+  if (S->alloc_site) return S->alloc_site(S->alloc_ud, ptr, size, file, line);
+  return S->alloc(S->alloc_ud, ptr, size);
+}
+
+static void *zrealloc_(State *S, void *ptr, size_t size,
+                       const char *file, unsigned line) {
+  void *p = state_alloc(S, ptr, size, file, line);
+  if (!p && size > 0) error_str(S, "out of memory");
+  return p;
+}
+
+/* the state's vecs (Program.inst) carry this as their own allocator, with
+ * the state as its userdata */
+static void *state_vec_alloc(void *ud, void *ptr, size_t size) {
+  return state_alloc(ud, ptr, size, __FILE__, __LINE__);
+}
+
+/*====================================================
+ * ALLOCATORS
+ *====================================================*/
+
+void *alloc_raw(void *ud, void *ptr, size_t size) {
+  UNUSED(ud);
+  if (size == 0) {
+    free(ptr);
     return NULL;
   }
-  void *p = dmt_realloc(ptr, size);
-  if (!p) error_str(S, "out of memory");
-  return p;
+  return realloc(ptr, size);
 }
 
-static void zfree(State *S, void *ptr) {
-  zrealloc(S, ptr, 0);
+void *alloc_dmt(void *ud, void *ptr, size_t size) {
+  UNUSED(ud);
+  if (size == 0) {
+    if (ptr) dmt_free(ptr);
+    return NULL;
+  }
+  return dmt_realloc(ptr, size);
+}
+
+void *alloc_dmt_site(void *ud, void *ptr, size_t size,
+                     const char *file, unsigned line) {
+  UNUSED(ud);
+  if (size == 0) {
+    if (ptr) _dmt_free(ptr, file, line);
+    return NULL;
+  }
+  return _dmt_realloc(ptr, size, file, line);
 }
 
 /*====================================================
@@ -51,14 +93,34 @@ void error_str(State *S, const char *fmt, ...) {
  *====================================================*/
 
 State *state_new(void) {
-  State *volatile S = NULL;
-  S = zrealloc(S, NULL, sizeof(*S));
+#ifdef BYTE_ALLOC_SITE
+  return state_new_alloc_site(BYTE_ALLOC_SITE, NULL);
+#else
+  return state_new_alloc(BYTE_ALLOC, NULL);
+#endif
+}
+
+State *state_new_alloc(AllocFn fn, void *ud) {
+  State *volatile S = fn(ud, NULL, sizeof(*S));
   if (!S) return NULL;
   memset(S, 0, sizeof(*S));
+  S->alloc = fn;
+  S->alloc_ud = ud;
+  return S;
+}
+
+State *state_new_alloc_site(AllocSiteFn fn, void *ud) {
+  State *volatile S = fn(ud, NULL, sizeof(*S), __FILE__, __LINE__);
+  if (!S) return NULL;
+  memset(S, 0, sizeof(*S));
+  S->alloc_site = fn;
+  S->alloc_ud = ud;
   return S;
 }
 
 static void state_close(State *S) {
+  program_delete(S, S->program_crnt);
+  program_delete(S, S->program_next);
   gc_deinit(S);
   zfree(S, S);
 }
@@ -237,6 +299,31 @@ Value *value_check(State *S, Value *v, int type) {
 }
 
 
+/*====================================================
+ * PROGRAM
+ *====================================================*/
+
+Program *program_new(State *S, char *name) {
+  size_t len = strlen(name);
+  Program *P = zrealloc(S, NULL, sizeof(*P));
+  P->name = zrealloc(S, NULL, len + 1);
+  memcpy(P->name, name, len + 1);
+  vec_init(&P->inst);
+  vecl_set_alloc(&P->inst, state_vec_alloc, S);
+  return P;
+}
+
+void program_push(State *S, Program *P, char *inst) {
+  if (vecl_push(&P->inst, inst) != 0) error_str(S, "out of memory");
+}
+
+void program_delete(State *S, Program *P) {
+  if (!P) return;
+  vecl_deinit(&P->inst);
+  zfree(S, P->name);
+  zfree(S, P);
+}
+
 /*====================================================
  * GARBAGE COLLECTOR
  *====================================================*/
@@ -315,6 +402,11 @@ static void gc_run(State *S) {
  *====================================================*/
 
 int main(void) {
+  /* BYTE_TRACE=<file> records every dmt allocation for tools/replay */
+  const char *trace_file = getenv("BYTE_TRACE");
+  FILE *trace = trace_file ? fopen(trace_file, "wb") : NULL;
+  if (trace) dmt_trace_start(trace);
+
   State *S = state_new();
   new_number(S, 1);
   new_number(S, 10);
@@ -338,4 +430,9 @@ int main(void) {
   // printf("size: %zu\n", S->gc_stack_idx);
 
   state_close(S);
+
+  if (trace) {
+    dmt_trace_stop();
+    fclose(trace);
+  }
 }
@@ -2,17 +2,29 @@
 #define BYTE_H
 
 #include "vec/vec.h"
+#include "arena/arena.h"
 
 #define STACK_SIZE 1024 /* for later use? */
 #define CHUNK_LEN 1024 /* max number of values in a given chunk */
 
-typedef vec_t(char*) vec_chptr_t; /* resizable array for program instructions */
+/* state_new() uses BYTE_ALLOC_SITE if defined, BYTE_ALLOC otherwise */
+#if !defined(BYTE_ALLOC) && !defined(BYTE_ALLOC_SITE)
+#define BYTE_ALLOC_SITE alloc_dmt_site /* dmt, recording the state's callsites */
+#endif
+
+typedef vecl_t(char*) vec_chptr_t; /* resizable array for program instructions */
 
 typedef struct State State;
 typedef struct Value Value;
 typedef struct Chunk Chunk;
 typedef struct Program Program;
 
+/* realloc-like allocator: ptr NULL allocates, size 0 frees */
+typedef void *(*AllocFn)(void *ud, void *ptr, size_t size);
+/* the same, also given the source location the memory is requested from */
+typedef void *(*AllocSiteFn)(void *ud, void *ptr, size_t size,
+                             const char *file, unsigned line);
+
 enum {
   OP_HLT, /* tell the program to halt */
   OP_PSH, /* push a value to the stack */
@@ -33,6 +45,9 @@ enum {
 };
 
 struct State {
+  AllocFn alloc;         /* allocator used for all of the state's memory */
+  AllocSiteFn alloc_site; /* or, if set, one that is also given callsites */
+  void *alloc_ud;        /* userdata passed to either */
   Program *program_crnt; /* current set of instructions to be executed */
   Program *program_next; /* a list of instructions sets to execute next */
   Value **program_stack; /* registers for the executing programs */
@@ -63,15 +78,23 @@ struct Chunk {
 
 struct Program {
   char *name;       /* name of the program */
-  vec_chptr_t inst; /* instructions to execute */
+  vec_chptr_t inst; /* instructions to execute, using the state's allocator */
 };
 
-State *state_new(void);                     /* create a new state */
+State *state_new(void);                     /* create a new state using BYTE_ALLOC(_SITE) */
+State *state_new_alloc(AllocFn fn, void *ud); /* create a new state using the given allocator */
+State *state_new_alloc_site(AllocSiteFn fn, void *ud); /* the same, passing callsites on */
 static void state_close(State *S);          /* close give state */
 static void state_push(State *S, Value *v); /* push a value in to the stack then add to current chunk */
 Value *state_pop(State *S);                 /* pop a value from the stack */
 static void state_show(State *S);           /* display the stack */
 
+void *alloc_raw(void *ud, void *ptr, size_t size);   /* plain malloc/realloc/free */
+void *alloc_dmt(void *ud, void *ptr, size_t size);   /* dmt tracked allocations */
+void *alloc_dmt_site(void *ud, void *ptr, size_t size,
+                     const char *file, unsigned line); /* alloc_dmt at the caller's callsite */
+/* alloc_arena() from arena/arena.h can also be used, with an Arena as ud */
+
 void error_out(State *S, Value *err);
 void error_str(State *S, const char *fmt, ...);
 
@@ -89,6 +112,10 @@ const char *value_to_string(State *S, Value *v);
 const char *value_type_str(int type);
 Value *value_check(State *S, Value *v, int type);
 
+Program *program_new(State *S, char *name);            /* creates an empty program */
+void program_push(State *S, Program *P, char *inst);   /* appends an instruction */
+void program_delete(State *S, Program *P);             /* frees a program and its instructions */
+
 static void gc_free(State *S, Value *v); /* set a value to nil */
 static void gc_deinit(State *S);         /* free all the values in all the chunks */
 static void gc_mark(State *S, Value *v); /* mark all reachable objetcs */
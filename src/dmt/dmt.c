@@ -5,9 +5,12 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "dmt.h"
 
@@ -18,12 +21,37 @@
 #endif
 #endif
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L &&\
+    !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_size_t dmt_counter_t;
+#define dmt_counter_get(c)    atomic_load_explicit(&(c), memory_order_relaxed)
+#define dmt_counter_set(c, n) atomic_store_explicit(&(c), n, memory_order_relaxed)
+#define dmt_counter_add(c, n)\
+  atomic_fetch_add_explicit(&(c), n, memory_order_relaxed)
+#define dmt_counter_sub(c, n)\
+  atomic_fetch_sub_explicit(&(c), n, memory_order_relaxed)
+#else
+typedef volatile size_t dmt_counter_t;
+#define dmt_counter_get(c)    (c)
+#define dmt_counter_set(c, n) ((c) = (n))
+#define dmt_counter_add(c, n) _dmt_counter_add(&(c), n)
+static size_t _dmt_counter_add(volatile size_t *c, size_t n) {
+  size_t old = *c;
+  *c += n;
+  return old;
+}
+#define dmt_counter_sub(c, n) ((c) -= (n))
+#endif
+
 
 typedef struct dmt_node_t {
   struct dmt_node_t *prev, *next;
   const char *file;
   size_t line;
   size_t size;
+  size_t birth;
+  unsigned long long id;
 #ifdef DMT_STACK_TRACE
   void  *stacktrace[DMT_STACK_TRACE_MAX];
   size_t stacktrace_sz;
@@ -33,6 +61,34 @@ typedef struct dmt_node_t {
 
 dmt_node_t *dmt_head;
 
+/* Running totals, kept so dmt_usage() and dmt_stats() are O(1). Writers are
+ * serialized by the caller (the node list is not thread-safe), so the peak can
+ * be updated with a plain load/store; readers on other threads see relaxed
+ * but tear-free values. */
+static dmt_counter_t dmt_live_bytes;
+static dmt_counter_t dmt_live_blocks;
+static dmt_counter_t dmt_total_allocs;
+static dmt_counter_t dmt_peak_bytes;
+
+/* Histograms by size class and by lifetime; lifetimes are measured on the
+ * allocation clock, i.e. the number of allocations made in between. */
+static dmt_counter_t dmt_hist_allocs[DMT_HIST_BUCKETS];
+static dmt_counter_t dmt_hist_live[DMT_HIST_BUCKETS];
+static dmt_counter_t dmt_hist_lifetimes[DMT_HIST_BUCKETS];
+
+/* Trace output; NULL unless dmt_trace_start() was called. Callsites are
+ * interned by (file, line) so each event only carries a small id. */
+typedef struct {
+  const char *file;
+  unsigned line;
+  unsigned long id;
+} dmt_site_t;
+
+static FILE *dmt_trace_fp;
+static dmt_site_t *dmt_sites;
+static size_t dmt_sites_len, dmt_sites_cap;
+static unsigned long long dmt_next_id;
+
 
 
 int _dmt_has_node(dmt_node_t *n) {
@@ -46,6 +102,141 @@ int _dmt_has_node(dmt_node_t *n) {
 
 
 
+static int _dmt_bucket(size_t n) {
+  int b = 0;
+  while (n) {
+    n >>= 1;
+    b++;
+  }
+  return b < DMT_HIST_BUCKETS ? b : DMT_HIST_BUCKETS - 1;
+}
+
+
+
+static void _dmt_count_alloc(dmt_node_t *node) {
+  size_t live = dmt_counter_add(dmt_live_bytes, node->size) + node->size;
+  int b = _dmt_bucket(node->size);
+  dmt_counter_add(dmt_live_blocks, 1);
+  /* the clock after this allocation, so a block freed before the next one
+   * has age 0 */
+  node->birth = dmt_counter_add(dmt_total_allocs, 1) + 1;
+  if (live > dmt_counter_get(dmt_peak_bytes)) {
+    dmt_counter_set(dmt_peak_bytes, live);
+  }
+  dmt_counter_add(dmt_hist_allocs[b], 1);
+  dmt_counter_add(dmt_hist_live[b], 1);
+}
+
+
+
+static void _dmt_count_free(dmt_node_t *node) {
+  size_t age = dmt_counter_get(dmt_total_allocs) - node->birth;
+  dmt_counter_sub(dmt_live_bytes, node->size);
+  dmt_counter_sub(dmt_live_blocks, 1);
+  dmt_counter_sub(dmt_hist_live[_dmt_bucket(node->size)], 1);
+  dmt_counter_add(dmt_hist_lifetimes[_dmt_bucket(age)], 1);
+}
+
+
+
+static void _dmt_put(FILE *fp, unsigned long long v, int n) {
+  while (n--) {
+    fputc((int)(v & 0xff), fp);
+    v >>= 8;
+  }
+}
+
+
+
+static int _dmt_get(FILE *fp, unsigned long long *v, int n) {
+  int i, c;
+  *v = 0;
+  for (i = 0; i < n; i++) {
+    if ((c = fgetc(fp)) == EOF) return -1;
+    *v |= (unsigned long long)c << (i * 8);
+  }
+  return 0;
+}
+
+
+
+static unsigned long long _dmt_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static size_t _dmt_site_hash(const char *file, unsigned line) {
+  return ((size_t)file >> 3) ^ (line * 2654435761u);
+}
+
+
+
+static unsigned long _dmt_site(const char *file, unsigned line) {
+  dmt_site_t *site;
+  size_t i, mask, len;
+
+  /* keep the table at most half full */
+  if ((dmt_sites_len + 1) * 2 > dmt_sites_cap) {
+    size_t cap = dmt_sites_cap ? dmt_sites_cap << 1 : 64;
+    dmt_site_t *sites = calloc(cap, sizeof(*sites));
+    if (!sites) {
+      if (dmt_sites_len + 1 >= dmt_sites_cap) return 0;
+    } else {
+      for (i = 0; i < dmt_sites_cap; i++) {
+        size_t j;
+        if (!dmt_sites[i].file) continue;
+        j = _dmt_site_hash(dmt_sites[i].file, dmt_sites[i].line) & (cap - 1);
+        while (sites[j].file) j = (j + 1) & (cap - 1);
+        sites[j] = dmt_sites[i];
+      }
+      free(dmt_sites);
+      dmt_sites = sites;
+      dmt_sites_cap = cap;
+    }
+  }
+
+  mask = dmt_sites_cap - 1;
+  i = _dmt_site_hash(file, line) & mask;
+  while (dmt_sites[i].file) {
+    if (dmt_sites[i].file == file && dmt_sites[i].line == line) {
+      return dmt_sites[i].id;
+    }
+    i = (i + 1) & mask;
+  }
+
+  site = &dmt_sites[i];
+  site->file = file;
+  site->line = line;
+  site->id = ++dmt_sites_len;
+
+  len = strlen(file);
+  if (len > 0xffff) len = 0xffff;
+  fputc(DMT_TRACE_SITE, dmt_trace_fp);
+  _dmt_put(dmt_trace_fp, site->id, 4);
+  _dmt_put(dmt_trace_fp, line, 4);
+  _dmt_put(dmt_trace_fp, len, 2);
+  fwrite(file, 1, len, dmt_trace_fp);
+
+  return site->id;
+}
+
+
+
+static void _dmt_trace(int kind, dmt_node_t *node, size_t sz,
+                       const char *file, unsigned line) {
+  unsigned long site = _dmt_site(file, line);
+  fputc(kind, dmt_trace_fp);
+  _dmt_put(dmt_trace_fp, node->id, 8);
+  _dmt_put(dmt_trace_fp, sz, 8);
+  _dmt_put(dmt_trace_fp, _dmt_now(), 8);
+  _dmt_put(dmt_trace_fp, site, 4);
+}
+
+
+
 void _dmt_abort(void) {
 #ifdef DMT_STACK_TRACE
   void *array[DMT_STACK_TRACE_MAX];
@@ -81,6 +272,7 @@ void *_dmt_alloc(size_t sz, int zeroset, const char *file, unsigned line) {
   node->line = line;
   node->file = file;
   node->size = sz;
+  node->id = ++dmt_next_id;
 
 #ifdef DMT_STACK_TRACE
   node->stacktrace_sz = backtrace(node->stacktrace, DMT_STACK_TRACE_MAX);
@@ -92,6 +284,9 @@ void *_dmt_alloc(size_t sz, int zeroset, const char *file, unsigned line) {
   }
   dmt_head = node;
 
+  _dmt_count_alloc(node);
+  if (dmt_trace_fp) _dmt_trace(DMT_TRACE_ALLOC, node, sz, file, line);
+
   return (char*)node + sizeof(*node);
 }
 
@@ -100,6 +295,7 @@ void *_dmt_alloc(size_t sz, int zeroset, const char *file, unsigned line) {
 void *_dmt_realloc(void *ptr, size_t sz, const char *file, unsigned line) {
   dmt_node_t *node = (dmt_node_t*)((char*)ptr - sizeof(*node));
   dmt_node_t *old_node = node;
+  size_t old_sz, live;
 
   if (ptr == NULL) return _dmt_alloc(sz, 0, file, line);
 
@@ -110,6 +306,7 @@ void *_dmt_realloc(void *ptr, size_t sz, const char *file, unsigned line) {
   }
 #endif
 
+  old_sz = node->size;
   node = realloc(node, sizeof(*node) + sz);
 
   if (node == NULL) {
@@ -126,6 +323,19 @@ void *_dmt_realloc(void *ptr, size_t sz, const char *file, unsigned line) {
   if (node->prev) node->prev->next = node;
   if (node->next) node->next->prev = node;
 
+  if (sz >= old_sz) {
+    live = dmt_counter_add(dmt_live_bytes, sz - old_sz) + (sz - old_sz);
+    if (live > dmt_counter_get(dmt_peak_bytes)) {
+      dmt_counter_set(dmt_peak_bytes, live);
+    }
+  } else {
+    dmt_counter_sub(dmt_live_bytes, old_sz - sz);
+  }
+  /* a realloc keeps the block's birth, it only moves its live size class */
+  dmt_counter_sub(dmt_hist_live[_dmt_bucket(old_sz)], 1);
+  dmt_counter_add(dmt_hist_live[_dmt_bucket(sz)], 1);
+  if (dmt_trace_fp) _dmt_trace(DMT_TRACE_REALLOC, node, sz, file, line);
+
   return (char*)node + sizeof(*node);
 }
 
@@ -147,6 +357,8 @@ void _dmt_free(void *ptr, const char *file, unsigned line) {
   if (node->prev) node->prev->next = node->next;
   if (node->next) node->next->prev = node->prev;
 
+  _dmt_count_free(node);
+  if (dmt_trace_fp) _dmt_trace(DMT_TRACE_FREE, node, node->size, file, line);
   free(node);
 }
 
@@ -193,15 +405,56 @@ size_t _dmt_size(void *ptr, const char* file, unsigned line) {
 
 
 size_t dmt_usage(void) {
-  dmt_node_t *node = dmt_head;
-  size_t total = 0;
+  return dmt_counter_get(dmt_live_bytes);
+}
 
-  while (node != NULL) {
-    total += node->size;
-    node = node->next;
+
+
+void dmt_stats(dmt_stats_t *st) {
+  st->live_bytes   = dmt_counter_get(dmt_live_bytes);
+  st->live_blocks  = dmt_counter_get(dmt_live_blocks);
+  st->total_allocs = dmt_counter_get(dmt_total_allocs);
+  st->peak_bytes   = dmt_counter_get(dmt_peak_bytes);
+}
+
+
+
+void dmt_hist(dmt_hist_t *h) {
+  int i;
+  h->clock = dmt_counter_get(dmt_total_allocs);
+  for (i = 0; i < DMT_HIST_BUCKETS; i++) {
+    h->allocs[i]    = dmt_counter_get(dmt_hist_allocs[i]);
+    h->live[i]      = dmt_counter_get(dmt_hist_live[i]);
+    h->lifetimes[i] = dmt_counter_get(dmt_hist_lifetimes[i]);
   }
+}
+
+
+
+void dmt_hist_dump(FILE *fp) {
+  dmt_hist_t h;
+  int i;
 
-  return total;
+  if (!fp) fp = stdout;
+  dmt_hist(&h);
+
+  fprintf(fp, "Allocation clock: %lu\n", (unsigned long)h.clock);
+  fprintf(fp, "%-24s %12s %12s %12s\n", "range", "allocs", "live", "freed@age");
+  for (i = 0; i < DMT_HIST_BUCKETS; i++) {
+    unsigned long lo = i ? 1ul << (i - 1) : 0;
+    char range[32];
+    if (!h.allocs[i] && !h.live[i] && !h.lifetimes[i]) continue;
+    if (i <= 1) {
+      sprintf(range, "%lu", lo);
+    } else if (i == DMT_HIST_BUCKETS - 1) {
+      sprintf(range, "%lu+", lo);
+    } else {
+      sprintf(range, "%lu-%lu", lo, (1ul << i) - 1);
+    }
+    fprintf(fp, "%-24s %12lu %12lu %12lu\n", range,
+            (unsigned long)h.allocs[i], (unsigned long)h.live[i],
+            (unsigned long)h.lifetimes[i]);
+  }
 }
 
 
@@ -210,3 +463,95 @@ int dmt_has(void *ptr) {
   dmt_node_t *node = (dmt_node_t*)((char*)ptr - sizeof(*node));
   return _dmt_has_node(node);
 }
+
+
+
+void dmt_trace_start(FILE *fp) {
+  free(dmt_sites);
+  dmt_sites = NULL;
+  dmt_sites_len = dmt_sites_cap = 0;
+  dmt_trace_fp = fp;
+  fputc(DMT_TRACE_HEADER, fp);
+  fwrite("DMT", 1, 3, fp);
+  _dmt_put(fp, DMT_TRACE_VERSION, 4);
+}
+
+
+
+void dmt_trace_stop(void) {
+  if (dmt_trace_fp) fflush(dmt_trace_fp);
+  dmt_trace_fp = NULL;
+  free(dmt_sites);
+  dmt_sites = NULL;
+  dmt_sites_len = dmt_sites_cap = 0;
+}
+
+
+
+void dmt_reader_init(dmt_reader_t *r, FILE *fp) {
+  r->fp = fp;
+  r->buf = NULL;
+  r->cap = 0;
+}
+
+
+
+void dmt_reader_deinit(dmt_reader_t *r) {
+  free(r->buf);
+  r->buf = NULL;
+  r->cap = 0;
+}
+
+
+
+int dmt_trace_read(dmt_reader_t *r, dmt_event_t *ev) {
+  FILE *fp = r->fp;
+  unsigned long long v, len;
+  char magic[3];
+  int kind = fgetc(fp);
+
+  if (kind == EOF) return 0;
+  memset(ev, 0, sizeof(*ev));
+  ev->kind = kind;
+
+  switch (kind) {
+    case DMT_TRACE_HEADER:
+      if (fread(magic, 1, 3, fp) != 3 || memcmp(magic, "DMT", 3)) return -1;
+      if (_dmt_get(fp, &v, 4)) return -1;
+      if (v != DMT_TRACE_VERSION) return -1;
+      return 1;
+
+    case DMT_TRACE_SITE:
+      if (_dmt_get(fp, &v, 4)) return -1;
+      ev->site = v;
+      if (_dmt_get(fp, &v, 4)) return -1;
+      ev->line = v;
+      if (_dmt_get(fp, &len, 2)) return -1;
+      if (len + 1 > r->cap) {
+        char *buf = realloc(r->buf, len + 1);
+        if (!buf) return -1;
+        r->buf = buf;
+        r->cap = len + 1;
+      }
+      if (fread(r->buf, 1, len, fp) != len) return -1;
+      r->buf[len] = '\0';
+      ev->file = r->buf;
+      ev->file_len = len;
+      return 1;
+
+    case DMT_TRACE_ALLOC:
+    case DMT_TRACE_REALLOC:
+    case DMT_TRACE_FREE:
+      if (_dmt_get(fp, &v, 8)) return -1;
+      ev->id = v;
+      if (_dmt_get(fp, &v, 8)) return -1;
+      ev->size = v;
+      if (_dmt_get(fp, &v, 8)) return -1;
+      ev->time = v;
+      if (_dmt_get(fp, &v, 4)) return -1;
+      ev->site = v;
+      return 1;
+  }
+
+  return -1;
+}
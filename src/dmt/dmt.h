@@ -16,6 +16,58 @@
 #define dmt_free(ptr)         _dmt_free(ptr, __FILE__, __LINE__)
 #define dmt_size(ptr)         _dmt_size(ptr, __FILE__, __LINE__)
 
+typedef struct {
+  size_t live_bytes;    /* bytes currently allocated */
+  size_t live_blocks;   /* blocks currently allocated */
+  size_t total_allocs;  /* allocations made since startup */
+  size_t peak_bytes;    /* high-water mark of live_bytes */
+} dmt_stats_t;
+
+/* Bucket 0 counts zero, bucket i counts values in [2^(i-1), 2^i), and the
+ * last bucket also holds everything larger. */
+#define DMT_HIST_BUCKETS 32
+
+typedef struct {
+  size_t clock;                       /* allocation clock (allocations made) */
+  size_t allocs[DMT_HIST_BUCKETS];    /* allocations by requested size */
+  size_t live[DMT_HIST_BUCKETS];      /* live blocks by current size */
+  size_t lifetimes[DMT_HIST_BUCKETS]; /* freed blocks by age in clock ticks */
+} dmt_hist_t;
+
+/* Binary trace format: a header record followed by one record per event.
+ * All integers are little-endian.
+ *   header:  'H' "DMT" u32 version
+ *   site:    'S' u32 site, u32 line, u16 len, char file[len]
+ *   alloc:   'A' u64 id, u64 size, u64 time_ns, u32 site
+ *   realloc: 'R' u64 id, u64 size, u64 time_ns, u32 site
+ *   free:    'F' u64 id, u64 size, u64 time_ns, u32 site
+ * Block ids are assigned in allocation order and kept across reallocs; a
+ * site record is written the first time a callsite is seen. */
+#define DMT_TRACE_VERSION 2
+#define DMT_TRACE_HEADER  'H'
+#define DMT_TRACE_SITE    'S'
+#define DMT_TRACE_ALLOC   'A'
+#define DMT_TRACE_REALLOC 'R'
+#define DMT_TRACE_FREE    'F'
+
+typedef struct {
+  int kind;
+  unsigned long long id;
+  unsigned long long size;
+  unsigned long long time;
+  unsigned long site;
+  unsigned line;
+  const char *file; /* site records only, NULL for all others; owned by the
+                     * reader and valid until its next read */
+  size_t file_len;
+} dmt_event_t;
+
+typedef struct {
+  FILE *fp;
+  char *buf;  /* holds the file name of the last site record */
+  size_t cap;
+} dmt_reader_t;
+
 void   *_dmt_alloc(size_t, int, const char*, unsigned);
 void   *_dmt_realloc(void*, size_t, const char*, unsigned);
 void    _dmt_free(void*, const char*, unsigned);
@@ -24,5 +76,13 @@ size_t  _dmt_size(void*, const char*, unsigned);
 void    dmt_dump(FILE*);
 size_t  dmt_usage(void);
 int     dmt_has(void *ptr);
+void    dmt_stats(dmt_stats_t *st);
+void    dmt_hist(dmt_hist_t *h);
+void    dmt_hist_dump(FILE*);
+void    dmt_trace_start(FILE *fp);
+void    dmt_trace_stop(void);
+void    dmt_reader_init(dmt_reader_t *r, FILE *fp);
+void    dmt_reader_deinit(dmt_reader_t *r);
+int     dmt_trace_read(dmt_reader_t *r, dmt_event_t *ev);
 
 #endif
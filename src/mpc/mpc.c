@@ -1,4 +1,25 @@
+#if defined(__unix__) || defined(__APPLE__)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#define MPC_POSIX
+#include <unistd.h>
+#endif
+
+#if defined(MPC_POSIX) && !defined(MPC_NO_MMAP)
+#define MPC_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "mpc.h"
+#include <limits.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+ && !defined(__CHAR_UNSIGNED__) && !defined(MPC_NO_SIMD)
+#define MPC_SIMD_X86
+#include <immintrin.h>
+#endif
 
 /*
 ** State Type
@@ -25,29 +46,35 @@ static mpc_state_t mpc_state_new(void) {
 */
 
 /*
-** In mpc the input type has three modes of 
-** operation: String, File and Pipe.
+** In mpc the input type has two modes of 
+** operation: String (also used for Files)
+** and Pipe.
 **
-** String is easy. The whole contents are 
-** loaded into a buffer and scanned through.
-** The cursor can jump around at will making 
-** backtracking easy.
+** String is easy. The caller's buffer is
+** scanned through in place - it is never
+** copied, so it must outlive the parse. Its
+** length is found once up front. The cursor
+** can jump around at will making backtracking
+** easy.
 **
 ** The second is a File which is also somewhat
-** easy. The contents are never loaded into 
-** memory but backtracking can still be achieved
-** by seeking in the file at different positions.
+** easy. Regular files are mapped into memory
+** and then scanned just like a String, so
+** backtracking is only a pointer reset. Files
+** which cannot be mapped are read in once, in
+** bulk, and scanned the same way.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and 
-** only support a single character lookahead at 
-** any point, when the input is marked for a 
-** potential backtracking we start buffering any 
-** input.
+** one. As we assume pipes cannot be seeked we
+** read them into a buffer a block (or a line)
+** at a time. Only the bytes from the oldest
+** mark onwards are kept, as nothing can seek
+** back before it, so memory is bounded by the
+** backtracking window rather than the input.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
-** buffer instead of the input.
+** buffer again.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -57,8 +84,7 @@ static mpc_state_t mpc_state_new(void) {
 
 enum {
   MPC_INPUT_STRING = 0,
-  MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 1
 };
 
 enum {
@@ -66,12 +92,58 @@ enum {
 };
 
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_BUFFER_MIN = 4096
+};
+
+enum {
+  MPC_ARENA_CHUNK_MIN = 512
+};
+
+typedef union {
+  size_t size;
+  long l;
+  double d;
+  void *p;
+} mpc_block_t;
+
+typedef struct mpc_chunk_t {
+  struct mpc_chunk_t *next;
+  size_t size;
+  mpc_block_t *data;
+} mpc_chunk_t;
+
+typedef struct {
+  mpc_chunk_t *chunk;
+  size_t used;
+} mpc_arena_t;
+
+#ifndef MPC_MEMO_BUDGET
+#define MPC_MEMO_BUDGET (1 << 24)
+#endif
+
+enum {
+  MPC_MEMO_SLOTS_MIN = 256
+};
+
+enum {
+  MPC_MEMO_FAILED  = 0,
+  MPC_MEMO_UNSAVED = 1,
+  MPC_MEMO_SAVED   = 2
 };
 
 typedef struct {
-  char mem[64];
-} mpc_mem_t;
+  const void *p;
+  long pos;
+  int flags;
+  int success;
+  mpc_state_t state;
+  char last;
+  mpc_val_t *output;
+  mpc_dtor_t dx;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+  size_t bytes;
+} mpc_memo_t;
 
 typedef struct {
 
@@ -79,9 +151,16 @@ typedef struct {
   char *filename;  
   mpc_state_t state;
   
-  char *string;
+  const char *string;
+  size_t length;
+  char *owned;
+  size_t mapped;
   char *buffer;
+  long buffer_pos;
+  size_t buffer_num;
+  size_t buffer_slots;
   FILE *file;
+  int eof;
   
   int suppress;
   int backtrack;
@@ -92,13 +171,19 @@ typedef struct {
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  mpc_arena_t *arenas;
+  mpc_arena_t arena;
+  mpc_chunk_t *chunks;
+  mpc_ast_arena_t *ast_arena;
+  
+  mpc_memo_t *memo;
+  size_t memo_slots;
+  size_t memo_num;
+  size_t memo_bytes;
   
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+static mpc_input_t *mpc_input_new_buffer(const char *filename, const char *string, size_t length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -108,10 +193,16 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = length;
+  i->owned = NULL;
+  i->mapped = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
+  i->eof = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
@@ -121,41 +212,28 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->arenas = malloc(sizeof(mpc_arena_t) * i->marks_slots);
+  i->arena.chunk = NULL;
+  i->arena.used = 0;
+  i->chunks = NULL;
+  i->ast_arena = NULL;
+  
+  i->memo = NULL;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo_bytes = 0;
   
   return i;
+
 }
 
 static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
+  const char *end = memchr(string, '\0', length);
+  return mpc_input_new_buffer(filename, string, end ? (size_t)(end - string) : length);
+}
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
-  
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  i->type = MPC_INPUT_STRING;
-  
-  i->state = mpc_state_new();
-  
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
-  i->buffer = NULL;
-  i->file = NULL;
-  
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-  
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
-  
-  return i;
-
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  return mpc_input_new_buffer(filename, string, strlen(string));
 }
 
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
@@ -169,8 +247,15 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
+  i->owned = NULL;
+  i->mapped = 0;
+  i->buffer_pos = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = MPC_INPUT_BUFFER_MIN;
+  i->buffer = malloc(i->buffer_slots);
   i->file = pipe;
+  i->eof = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
@@ -180,76 +265,204 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->arenas = malloc(sizeof(mpc_arena_t) * i->marks_slots);
+  i->arena.chunk = NULL;
+  i->arena.used = 0;
+  i->chunks = NULL;
+  i->ast_arena = NULL;
+  
+  i->memo = NULL;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo_bytes = 0;
   
   return i;
   
 }
 
-static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
+#ifdef MPC_MMAP
+static char *mpc_input_map(FILE *file, size_t *skip, size_t *mapped) {
   
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  struct stat st;
+  long pos = ftell(file);
+  char *map;
   
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  i->type = MPC_INPUT_FILE;
-  i->state = mpc_state_new();
+  if (pos < 0 || fstat(fileno(file), &st) != 0) { return NULL; }
+  if (!S_ISREG(st.st_mode) || st.st_size <= pos) { return NULL; }
   
-  i->string = NULL;
-  i->buffer = NULL;
-  i->file = file;
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (map == MAP_FAILED) { return NULL; }
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
+  fseek(file, 0, SEEK_END);
+  *skip = pos;
+  *mapped = st.st_size;
+  return map;
+}
+#endif
+
+static char *mpc_input_read(FILE *file, size_t *length) {
+  
+  size_t size = 4096, n = 0, k;
+  char *buffer = malloc(size);
+  
+  while ((k = fread(buffer + n, 1, size - n, file)) > 0) {
+    n += k;
+    if (n == size) {
+      size *= 2;
+      buffer = realloc(buffer, size);
+    }
+  }
+  
+  *length = n;
+  return buffer;
+}
+
+static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
+  
+  mpc_input_t *i;
+  char *contents = NULL;
+  size_t length = 0, skip = 0, mapped = 0;
+  
+#ifdef MPC_MMAP
+  contents = mpc_input_map(file, &skip, &mapped);
+  length = mapped - skip;
+#endif
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  if (!contents) { contents = mpc_input_read(file, &length); }
   
+  i = mpc_input_new_buffer(filename, contents + skip, length);
+  i->owned = contents;
+  i->mapped = mapped;
   return i;
 }
 
+static void mpc_memo_clear(mpc_input_t *i);
+static void mpc_ast_arena_delete(mpc_ast_arena_t *r);
+
 static void mpc_input_delete(mpc_input_t *i) {
   
+  mpc_chunk_t *c;
+  
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+  mpc_memo_clear(i);
+  
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
+#ifdef MPC_MMAP
+  if (i->mapped) { munmap(i->owned, i->mapped); } else
+#endif
+  free(i->owned);
+  
+  while (i->chunks) {
+    c = i->chunks;
+    i->chunks = c->next;
+    free(c->data);
+    free(c);
+  }
+  
+  if (i->ast_arena) { mpc_ast_arena_delete(i->ast_arena); }
+  
   free(i->marks);
   free(i->lasts);
+  free(i->arenas);
   free(i);
 }
 
-static int mpc_mem_ptr(mpc_input_t *i, void *p) {
+/*
+** Parse Arena
+*/
+
+/*
+** Values made while parsing are bumped off the
+** top of an arena. Every input mark remembers
+** where the top was, so a rewind throws away
+** all a failed branch made in one go. A block
+** can only be given back or grown in place if
+** it is on top and newer than the innermost
+** mark - otherwise rewinding to that mark would
+** cut it in two. Each block is headed by its
+** size, for exporting and growing it. Chunks
+** live as long as the input and are reused
+** after a rewind.
+*/
+
+static size_t mpc_arena_units(size_t n) {
+  return (n + sizeof(mpc_block_t) - 1) / sizeof(mpc_block_t);
+}
+
+static int mpc_chunk_has(mpc_chunk_t *c, void *p) {
   return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+    (mpc_block_t*)p >  c->data &&
+    (mpc_block_t*)p <= c->data + c->size;
+}
+
+static int mpc_arena_owns(mpc_input_t *i, void *p) {
+  mpc_chunk_t *c;
+  if (i->arena.chunk && mpc_chunk_has(i->arena.chunk, p)) { return 1; }
+  for (c = i->chunks; c; c = c->next) {
+    if (mpc_chunk_has(c, p)) { return 1; }
+  }
+  return 0;
+}
+
+static int mpc_arena_above(mpc_input_t *i, mpc_block_t *b) {
+  mpc_arena_t *m = i->marks_num > 0 ? &i->arenas[i->marks_num-1] : NULL;
+  return !m || m->chunk != i->arena.chunk || b >= m->chunk->data + m->used;
+}
+
+static int mpc_arena_top(mpc_input_t *i, mpc_block_t *b) {
+  mpc_arena_t *a = &i->arena;
+  if (!a->chunk || b + 1 + mpc_arena_units(b->size) != a->chunk->data + a->used) { return 0; }
+  return mpc_arena_above(i, b);
+}
+
+/* checks the blocks `xs` lie one after another up to the top */
+static int mpc_arena_stacked(mpc_input_t *i, int n, void **xs) {
+  int j;
+  mpc_block_t *b = NULL;
+  for (j = 0; j < n; j++) {
+    if (!i->arena.chunk || !mpc_chunk_has(i->arena.chunk, xs[j])) { return 0; }
+    if (b && b + 1 + mpc_arena_units(b->size) + 1 != (mpc_block_t*)xs[j]) { return 0; }
+    b = (mpc_block_t*)xs[j] - 1;
+  }
+  return mpc_arena_top(i, b) && mpc_arena_above(i, (mpc_block_t*)xs[0] - 1);
+}
+
+/* moves the top to the next chunk with room for `n` units */
+static void mpc_arena_grow(mpc_input_t *i, size_t n) {
+
+  mpc_chunk_t *c = i->arena.chunk;
+  mpc_chunk_t *next = c ? c->next : i->chunks;
+  mpc_chunk_t *d;
+
+  if (!next || next->size < n) {
+    d = malloc(sizeof(mpc_chunk_t));
+    d->size = c ? c->size * 2 : MPC_ARENA_CHUNK_MIN;
+    if (d->size < n) { d->size = n; }
+    d->data = malloc(sizeof(mpc_block_t) * d->size);
+    d->next = next;
+    if (c) { c->next = d; } else { i->chunks = d; }
+    next = d;
+  }
+
+  i->arena.chunk = next;
+  i->arena.used = 0;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
-  
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
-  
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
-  
-  return malloc(n);
+
+  size_t m = mpc_arena_units(n) + 1;
+  mpc_block_t *b;
+
+  if (!i->arena.chunk || i->arena.used + m > i->arena.chunk->size) {
+    mpc_arena_grow(i, m);
+  }
+
+  b = i->arena.chunk->data + i->arena.used;
+  b->size = n;
+  i->arena.used += m;
+  return b + 1;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,35 +472,422 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  mpc_block_t *b;
+  if (!mpc_arena_owns(i, p)) { free(p); return; }
+  b = (mpc_block_t*)p - 1;
+  if (mpc_arena_top(i, b)) { i->arena.used = (size_t)(b - i->arena.chunk->data); }
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
-  
-  char *q = NULL;
-  
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
-  
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
-    return q;
+
+  mpc_block_t *b;
+  size_t j;
+  char *q;
+
+  if (!mpc_arena_owns(i, p)) { return realloc(p, n); }
+
+  b = (mpc_block_t*)p - 1;
+
+  if (mpc_arena_top(i, b)) {
+    j = (size_t)(b - i->arena.chunk->data) + 1 + mpc_arena_units(n);
+    if (j <= i->arena.chunk->size) {
+      b->size = n;
+      i->arena.used = j;
+      return p;
+    }
   }
-  
-  return p;
+
+  if (n <= b->size) { return p; }
+
+  q = mpc_malloc(i, n);
+  memcpy(q, p, b->size);
+  return q;
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
-  if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  if (!mpc_arena_owns(i, p)) { return p; }
+  q = malloc(((mpc_block_t*)p - 1)->size);
+  memcpy(q, p, ((mpc_block_t*)p - 1)->size);
   mpc_free(i, p);
-  return q; 
+  return q;
+}
+
+/*
+** Symbol Tables
+*/
+
+/*
+** Strings are numbered in the order they are
+** first added, and found again through an open
+** addressed table of those numbers.
+*/
+
+typedef struct {
+  int num;
+  int slots;
+  char **names;
+  int *table;
+} mpc_symbols_t;
+
+static size_t mpc_tag_hash(const char *x) {
+  size_t h = 0;
+  while (*x) { h = h * 31 + (unsigned char)*x++; }
+  h ^= h >> 15;
+  h *= 0x2c1b3c6dUL;
+  h ^= h >> 12;
+  return h;
+}
+
+static void mpc_symbols_init(mpc_symbols_t *s) {
+  s->num = 0;
+  s->slots = 0;
+  s->names = NULL;
+  s->table = NULL;
+}
+
+static void mpc_symbols_clear(mpc_symbols_t *s) {
+  int k;
+  for (k = 0; k < s->num; k++) { free(s->names[k]); }
+  free(s->names);
+  free(s->table);
+}
+
+/* gives -1 for strings not in the table unless `add` is set */
+static int mpc_symbols_find(mpc_symbols_t *s, const char *x, int add) {
+
+  size_t j;
+  int k;
+
+  if (add && 2 * (s->num + 1) > s->slots) {
+    s->slots = s->slots ? 2 * s->slots : 16;
+    s->table = realloc(s->table, sizeof(int) * s->slots);
+    s->names = realloc(s->names, sizeof(char*) * (s->slots / 2));
+    for (j = 0; j < (size_t)s->slots; j++) { s->table[j] = -1; }
+    for (k = 0; k < s->num; k++) {
+      j = mpc_tag_hash(s->names[k]) & (size_t)(s->slots - 1);
+      while (s->table[j] >= 0) { j = (j + 1) & (size_t)(s->slots - 1); }
+      s->table[j] = k;
+    }
+  }
+
+  if (s->slots == 0) { return -1; }
+
+  j = mpc_tag_hash(x) & (size_t)(s->slots - 1);
+  while (s->table[j] >= 0) {
+    if (strcmp(s->names[s->table[j]], x) == 0) { return s->table[j]; }
+    j = (j + 1) & (size_t)(s->slots - 1);
+  }
+
+  if (!add) { return -1; }
+
+  s->names[s->num] = malloc(strlen(x) + 1);
+  strcpy(s->names[s->num], x);
+  s->table[j] = s->num;
+  return s->num++;
+}
+
+/*
+** AST Arena
+*/
+
+/*
+** Leaves made by `mpcf_str_ast_arena` come from
+** an arena kept by the input, and the folds put
+** any node built over them in the same arena.
+** If the parse succeeds the root of its output
+** takes the arena over, otherwise it goes with
+** the input. Nothing in it is given back alone,
+** so nodes dropped by backtracking stay there
+** until the whole tree is deleted.
+**
+** Tags are interned in the arena, so nodes all
+** share one copy of each and also hold its id.
+** Putting a rule name in front of a tag is then
+** looked up by the pair of ids after it has
+** been done once.
+**
+** Nodes from elsewhere added to a tree in the
+** arena are moved in where they are, so the
+** caller's pointers to them stay good. A heap
+** node keeps its own struct, which the arena
+** frees along with everything else, and the
+** arena of another tree's root is kept until
+** this one goes.
+*/
+
+typedef struct {
+  int x;
+  int y;
+  int id;
+} mpc_tag_join_t;
+
+struct mpc_ast_arena_t {
+  mpc_chunk_t *chunks;
+  size_t used;
+  mpc_ast_t *root;
+  mpc_symbols_t tags;
+  int joins_num;
+  int joins_slots;
+  mpc_tag_join_t *joins;
+  char *empty;
+  int spans;
+  char *owned;
+  size_t mapped;
+  mpc_ast_t **adopted;
+  int adopted_num;
+  int adopted_slots;
+  mpc_ast_arena_t *kept;
+  mpc_ast_arena_t *next;
+};
+
+static mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *r = malloc(sizeof(mpc_ast_arena_t));
+  r->chunks = NULL;
+  r->used = 0;
+  r->root = NULL;
+  mpc_symbols_init(&r->tags);
+  r->joins_num = 0;
+  r->joins_slots = 0;
+  r->joins = NULL;
+  r->empty = NULL;
+  r->spans = 0;
+  r->owned = NULL;
+  r->mapped = 0;
+  r->adopted = NULL;
+  r->adopted_num = 0;
+  r->adopted_slots = 0;
+  r->kept = NULL;
+  r->next = NULL;
+  return r;
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t *r) {
+  mpc_chunk_t *c;
+  mpc_ast_arena_t *k;
+  int j;
+  while (r->chunks) {
+    c = r->chunks;
+    r->chunks = c->next;
+    free(c->data);
+    free(c);
+  }
+  while (r->kept) {
+    k = r->kept;
+    r->kept = k->next;
+    mpc_ast_arena_delete(k);
+  }
+  for (j = 0; j < r->adopted_num; j++) { free(r->adopted[j]); }
+  free(r->adopted);
+  mpc_symbols_clear(&r->tags);
+  free(r->joins);
+#ifdef MPC_MMAP
+  if (r->mapped) { munmap(r->owned, r->mapped); } else
+#endif
+  free(r->owned);
+  free(r);
+}
+
+static int mpc_ast_arena_owns(mpc_ast_arena_t *r, void *p) {
+  mpc_chunk_t *c;
+  for (c = r->chunks; c; c = c->next) {
+    if ((mpc_block_t*)p >= c->data
+    &&  (mpc_block_t*)p <  c->data + c->size) { return 1; }
+  }
+  return 0;
+}
+
+static void *mpc_ast_arena_malloc(mpc_ast_arena_t *r, size_t n) {
+
+  size_t m = mpc_arena_units(n);
+  mpc_chunk_t *c = r->chunks;
+  void *p;
+
+  if (!c || r->used + m > c->size) {
+    c = malloc(sizeof(mpc_chunk_t));
+    c->size = r->chunks ? r->chunks->size * 2 : MPC_ARENA_CHUNK_MIN;
+    if (c->size < m) { c->size = m; }
+    c->data = malloc(sizeof(mpc_block_t) * c->size);
+    c->next = r->chunks;
+    r->chunks = c;
+    r->used = 0;
+  }
+
+  p = c->data + r->used;
+  r->used += m;
+  return p;
+}
+
+/* sets the tag of `a` to the one numbered `id` */
+static mpc_ast_t *mpc_ast_arena_tag_id(mpc_ast_t *a, int id) {
+  a->tag_id = id;
+  a->tag = a->arena->tags.names[id];
+  return a;
+}
+
+static size_t mpc_tag_join_hash(int x, int y) {
+  size_t h = (size_t)x * 31 + (size_t)y;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6dUL;
+  h ^= h >> 12;
+  return h;
+}
+
+/*
+** Gives the id of `t` put in front of the tag
+** numbered `y`, joined by a `|`, or for `root`
+** with the last char of `t` replaced by it.
+*/
+
+static int mpc_ast_arena_join(mpc_ast_arena_t *r, const char *t, int root, int y) {
+
+  int x = 2 * mpc_symbols_find(&r->tags, t, 1) + root;
+  int k, id;
+  size_t j, n;
+  mpc_tag_join_t *js;
+  char *z;
+
+  if (2 * (r->joins_num + 1) > r->joins_slots) {
+    js = r->joins;
+    n = (size_t)r->joins_slots;
+    r->joins_slots = r->joins_slots ? 2 * r->joins_slots : 64;
+    r->joins = malloc(sizeof(mpc_tag_join_t) * r->joins_slots);
+    for (j = 0; j < (size_t)r->joins_slots; j++) { r->joins[j].id = -1; }
+    for (k = 0; k < (int)n; k++) {
+      if (js[k].id < 0) { continue; }
+      j = mpc_tag_join_hash(js[k].x, js[k].y) & (size_t)(r->joins_slots - 1);
+      while (r->joins[j].id >= 0) { j = (j + 1) & (size_t)(r->joins_slots - 1); }
+      r->joins[j] = js[k];
+    }
+    free(js);
+  }
+
+  j = mpc_tag_join_hash(x, y) & (size_t)(r->joins_slots - 1);
+  while (r->joins[j].id >= 0) {
+    if (r->joins[j].x == x && r->joins[j].y == y) { return r->joins[j].id; }
+    j = (j + 1) & (size_t)(r->joins_slots - 1);
+  }
+
+  n = root ? strlen(t) - 1 : strlen(t) + 1;
+  z = malloc(n + strlen(r->tags.names[y]) + 1);
+  memcpy(z, t, n);
+  if (!root) { z[n-1] = '|'; }
+  strcpy(z + n, r->tags.names[y]);
+  id = mpc_symbols_find(&r->tags, z, 1);
+  free(z);
+
+  r->joins[j].x = x;
+  r->joins[j].y = y;
+  r->joins[j].id = id;
+  r->joins_num++;
+  return id;
+}
+
+/* contents outside an arena may have been changed, so are measured again */
+static long mpc_ast_contents_len(mpc_ast_t *a) {
+  return a->arena ? a->contents_len : (long)strlen(a->contents);
+}
+
+static void mpc_ast_arena_contents(mpc_ast_t *a, const char *contents, long n) {
+  mpc_ast_arena_t *r = a->arena;
+  if (n == 0) {
+    if (!r->empty) { r->empty = mpc_ast_arena_malloc(r, 1); r->empty[0] = '\0'; }
+    a->contents = r->empty;
+  } else {
+    a->contents = mpc_ast_arena_malloc(r, (size_t)n + 1);
+    memcpy(a->contents, contents, (size_t)n);
+    a->contents[n] = '\0';
+  }
+  a->contents_len = n;
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *r, const char *tag, const char *contents, long n) {
+  mpc_ast_t *a = mpc_ast_arena_malloc(r, sizeof(mpc_ast_t));
+  a->arena = r;
+  mpc_ast_arena_tag_id(a, mpc_symbols_find(&r->tags, tag, 1));
+  mpc_ast_arena_contents(a, contents, n);
+  a->state = mpc_state_new();
+  a->children_num = 0;
+  a->children = NULL;
+  a->children_slots = 0;
+  return a;
+}
+
+static mpc_ast_t *mpc_ast_arena_copy(mpc_ast_arena_t *r, mpc_ast_t *a) {
+
+  int i;
+  mpc_ast_t *b = mpc_ast_arena_node(r, a->tag, a->contents, mpc_ast_contents_len(a));
+  b->state = a->state;
+
+  if (a->children_num) {
+    b->children_num = a->children_num;
+    b->children_slots = a->children_num;
+    b->children = mpc_ast_arena_malloc(r, sizeof(mpc_ast_t*) * a->children_num);
+    for (i = 0; i < a->children_num; i++) {
+      b->children[i] = a->children[i] ? mpc_ast_arena_copy(r, a->children[i]) : NULL;
+    }
+  }
+
+  return b;
+}
+
+/* retags the nodes of another arena's tree, whose arena is kept by `r` */
+static void mpc_ast_arena_retag(mpc_ast_arena_t *r, mpc_ast_t *a) {
+  int i;
+  for (i = 0; i < a->children_num; i++) {
+    if (a->children[i]) { mpc_ast_arena_retag(r, a->children[i]); }
+  }
+  a->arena = r;
+  mpc_ast_arena_tag_id(a, mpc_symbols_find(&r->tags, a->tag, 1));
+}
+
+/*
+** Moves a tree from elsewhere into the arena,
+** giving the node to put in it. Only a node in
+** the middle of another arena's tree is copied,
+** as that tree still owns it.
+*/
+static mpc_ast_t *mpc_ast_arena_adopt(mpc_ast_arena_t *r, mpc_ast_t *a) {
+
+  int i;
+  char *tag, *contents;
+  mpc_ast_t **cs = NULL;
+
+  if (a->arena == r) { return a; }
+
+  if (a->arena) {
+    if (a->arena->root != a) { return mpc_ast_arena_copy(r, a); }
+    a->arena->root = NULL;
+    a->arena->next = r->kept;
+    r->kept = a->arena;
+    mpc_ast_arena_retag(r, a);
+    return a;
+  }
+
+  if (r->adopted_num >= r->adopted_slots) {
+    r->adopted_slots = r->adopted_slots ? 2 * r->adopted_slots : 16;
+    r->adopted = realloc(r->adopted, sizeof(mpc_ast_t*) * r->adopted_slots);
+  }
+  r->adopted[r->adopted_num++] = a;
+
+  if (a->children_num) {
+    cs = mpc_ast_arena_malloc(r, sizeof(mpc_ast_t*) * a->children_num);
+    for (i = 0; i < a->children_num; i++) {
+      cs[i] = a->children[i] ? mpc_ast_arena_adopt(r, a->children[i]) : NULL;
+    }
+  }
+  free(a->children);
+  a->children = cs;
+  a->children_slots = a->children_num;
+
+  tag = a->tag;
+  contents = a->contents;
+  a->arena = r;
+  mpc_ast_arena_tag_id(a, mpc_symbols_find(&r->tags, tag, 1));
+  mpc_ast_arena_contents(a, contents, (long)strlen(contents));
+  free(tag);
+  free(contents);
+  return a;
 }
 
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
@@ -306,14 +906,12 @@ static void mpc_input_mark(mpc_input_t *i) {
     i->marks_slots = i->marks_num + i->marks_num / 2;
     i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
+    i->arenas = realloc(i->arenas, sizeof(mpc_arena_t) * i->marks_slots);
   }
 
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
-  
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
+  i->arenas[i->marks_num-1] = i->arena;
   
 }
 
@@ -330,11 +928,7 @@ static void mpc_input_unmark(mpc_input_t *i) {
       i->marks_num : MPC_INPUT_MARKS_MIN;
     i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
-  }
-  
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+    i->arenas = realloc(i->arenas, sizeof(mpc_arena_t) * i->marks_slots);
   }
   
 }
@@ -345,119 +939,93 @@ static void mpc_input_rewind(mpc_input_t *i) {
   
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
-  
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
+  i->arena = i->arenas[i->marks_num-1];
   
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
+/*
+** Makes sure the character at the cursor is
+** in the pipe buffer, returning 0 at the end
+** of input. When the buffer is full we drop
+** whatever lies before the oldest mark - but
+** only if that frees at least half of it, and
+** otherwise we grow it, so each byte is moved
+** a constant number of times on average.
+** On POSIX systems each fill is one `read` of
+** the stream's descriptor, which returns what
+** is available rather than waiting for more,
+** so pipes written a little at a time are not
+** stalled. Elsewhere we read up to a newline.
+*/
 
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
+static int mpc_input_buffer_fill(mpc_input_t *i) {
+  
+  long keep;
+  size_t n;
+#ifdef MPC_POSIX
+  ssize_t k;
+#else
+  int c;
+#endif
+  
+  if (i->state.pos < i->buffer_pos + (long)i->buffer_num) { return 1; }
+  if (i->eof) { return 0; }
+  
+  if (i->buffer_num == i->buffer_slots) {
+    keep = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+    n = (size_t)(keep - i->buffer_pos);
+    if (n >= i->buffer_slots / 2) {
+      memmove(i->buffer, i->buffer + n, i->buffer_num - n);
+      i->buffer_pos = keep;
+      i->buffer_num -= n;
+    } else {
+      i->buffer_slots *= 2;
+      i->buffer = realloc(i->buffer, i->buffer_slots);
+    }
+  }
+  
+#ifdef MPC_POSIX
+  do {
+    k = read(fileno(i->file), i->buffer + i->buffer_num,
+      i->buffer_slots - i->buffer_num);
+  } while (k < 0 && errno == EINTR);
+  if (k <= 0) { i->eof = 1; } else { i->buffer_num += (size_t)k; }
+#else
+  /* stop at newlines so interactive pipes are never waited on */
+  while (i->buffer_num < i->buffer_slots) {
+    c = getc(i->file);
+    if (c == EOF) { i->eof = 1; break; }
+    i->buffer[i->buffer_num++] = (char)c;
+    if (c == '\n') { break; }
+  }
+#endif
+  
+  return i->state.pos < i->buffer_pos + (long)i->buffer_num;
+}
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
-  if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)i->length) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && !mpc_input_buffer_fill(i)) { return 1; }
   return 0;
 }
 
 static char mpc_input_getc(mpc_input_t *i) {
   
-  char c = '\0';
-  
-  switch (i->type) {
-    
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-    
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
-    
-    default: return c;
-  }
-}
-
-static char mpc_input_peekc(mpc_input_t *i) {
-  
-  char c = '\0';
-  
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: 
-      
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
-      
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
     
+    case MPC_INPUT_STRING:
+      return i->state.pos < (long)i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_PIPE:
-      
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+      if (!mpc_input_buffer_fill(i)) { return '\0'; }
+      return i->buffer[i->state.pos - i->buffer_pos];
     
-    default: return c;
-  }
-  
-}
-
-static int mpc_input_failure(mpc_input_t *i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-      
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file); 
-      }
-    }
-    default: { break; }
+    default: return '\0';
   }
-  return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-  
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -485,31 +1053,31 @@ static int mpc_input_any(mpc_input_t *i, char **o) {
 static int mpc_input_char(mpc_input_t *i, char c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return x == c ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return x == c ? mpc_input_success(i, x, o) : 0;
 }
 
 static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return x >= c && x <= d ? mpc_input_success(i, x, o) : 0;  
 }
 
 static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : 0;  
 }
 
 static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : 0;  
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return cond(x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return cond(x) ? mpc_input_success(i, x, o) : 0;  
 }
 
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
@@ -533,7 +1101,7 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
 
 static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
   *o = NULL;
-  return f(i->last, mpc_input_peekc(i));
+  return f(i->last, mpc_input_getc(i));
 }
 
 static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
@@ -640,29 +1208,29 @@ char *mpc_err_string(mpc_err_t *x) {
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
-  x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
+  x = malloc(sizeof(mpc_err_t));
+  x->filename = malloc(strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
   x->state = i->state;
   x->expected_num = 1;
-  x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
+  x->expected = malloc(sizeof(char*));
+  x->expected[0] = malloc(strlen(expected) + 1);
   strcpy(x->expected[0], expected);
   x->failure = NULL;
-  x->recieved = mpc_input_peekc(i);
+  x->recieved = mpc_input_getc(i);
   return x;
 }
 
 static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
-  x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
+  x = malloc(sizeof(mpc_err_t));
+  x->filename = malloc(strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
   x->state = i->state;
   x->expected_num = 0;
   x->expected = NULL;
-  x->failure = mpc_malloc(i, strlen(failure) + 1);
+  x->failure = malloc(strlen(failure) + 1);
   strcpy(x->failure, failure);
   x->recieved = ' ';
   return x;
@@ -682,25 +1250,38 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
   return x;
 }
 
-static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
   int j;
-  if (x == NULL) { return; }
-  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
-  mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
-  mpc_free(i, x->failure);
-  mpc_free(i, x);
+  mpc_err_t *y = malloc(sizeof(mpc_err_t));
+  y->state = x->state;
+  y->expected_num = x->expected_num;
+  y->recieved = x->recieved;
+  y->filename = malloc(strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->expected = NULL;
+  if (x->expected_num) {
+    y->expected = malloc(sizeof(char*) * x->expected_num);
+  }
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  return y;
 }
 
-static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
+/* the bytes held by a copy of `x` */
+static size_t mpc_err_size(mpc_err_t *x) {
   int j;
-  for (j = 0; j < x->expected_num; j++) {
-    x->expected[j] = mpc_export(i, x->expected[j]);
-  }
-  x->expected = mpc_export(i, x->expected);
-  x->filename = mpc_export(i, x->filename);
-  x->failure = mpc_export(i, x->failure);
-  return mpc_export(i, x);
+  size_t n = sizeof(mpc_err_t) + strlen(x->filename) + 1;
+  if (x->failure) { n += strlen(x->failure) + 1; }
+  n += sizeof(char*) * x->expected_num;
+  for (j = 0; j < x->expected_num; j++) { n += strlen(x->expected[j]) + 1; }
+  return n;
 }
 
 static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
@@ -715,8 +1296,8 @@ static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expecte
 static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
   (void)i;
   x->expected_num++;
-  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num-1] = mpc_malloc(i, strlen(expected) + 1);
+  x->expected = realloc(x->expected, sizeof(char*) * x->expected_num);
+  x->expected[x->expected_num-1] = malloc(strlen(expected) + 1);
   strcpy(x->expected[x->expected_num-1], expected);
 }
 
@@ -732,12 +1313,12 @@ static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
   
   if (fst == -1) { return NULL; }
   
-  e = mpc_malloc(i, sizeof(mpc_err_t));
+  e = malloc(sizeof(mpc_err_t));
   e->state = mpc_state_invalid();
   e->expected_num = 0;
   e->expected = NULL;
   e->failure = NULL;
-  e->filename = mpc_malloc(i, strlen(x[fst]->filename)+1);
+  e->filename = malloc(strlen(x[fst]->filename)+1);
   strcpy(e->filename, x[fst]->filename);
   
   for (j = 0; j < n; j++) {
@@ -750,7 +1331,7 @@ static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
     if (x[j]->state.pos < e->state.pos) { continue; }
     
     if (x[j]->failure) {
-      e->failure = mpc_malloc(i, strlen(x[j]->failure)+1);
+      e->failure = malloc(strlen(x[j]->failure)+1);
       strcpy(e->failure, x[j]->failure);
       break;
     }
@@ -766,7 +1347,7 @@ static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
   
   for (j = 0; j < n; j++) {
     if (x[j] == NULL) { continue; }
-    mpc_err_delete_internal(i, x[j]);
+    mpc_err_delete(x[j]);
   }
   
   return e;
@@ -777,22 +1358,23 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
   int j = 0;
   size_t l = 0;
   char *expect = NULL;
+  (void)i;
   
   if (x == NULL) { return NULL; }
   
   if (x->expected_num == 0) {
-    expect = mpc_calloc(i, 1, 1);
+    expect = calloc(1, 1);
     x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
+    x->expected = realloc(x->expected, sizeof(char*) * x->expected_num);
     x->expected[0] = expect;
     return x;
   }
   
   else if (x->expected_num == 1) {
-    expect = mpc_malloc(i, strlen(prefix) + strlen(x->expected[0]) + 1);
+    expect = malloc(strlen(prefix) + strlen(x->expected[0]) + 1);
     strcpy(expect, prefix);
     strcat(expect, x->expected[0]);
-    mpc_free(i, x->expected[0]);
+    free(x->expected[0]);
     x->expected[0] = expect;
     return x;
   }
@@ -807,7 +1389,7 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
     l += strlen(" or ");
     l += strlen(x->expected[x->expected_num-1]);
     
-    expect = mpc_malloc(i, l + 1);
+    expect = malloc(l + 1);
     
     strcpy(expect, prefix);
     for (j = 0; j < x->expected_num-2; j++) {
@@ -817,10 +1399,10 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
     strcat(expect, " or ");
     strcat(expect, x->expected[x->expected_num-1]);
 
-    for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
+    for (j = 0; j < x->expected_num; j++) { free(x->expected[j]); }
     
     x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
+    x->expected = realloc(x->expected, sizeof(char*) * x->expected_num);
     x->expected[0] = expect;
     return x;
   }
@@ -836,10 +1418,10 @@ static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
   mpc_err_t *y;
   int digits = n/10 + 1;
   char *prefix;
-  prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
+  prefix = malloc(digits + strlen(" of ") + 1);
   sprintf(prefix, "%i of ", n);
   y = mpc_err_repeat(i, x, prefix);
-  mpc_free(i, prefix);
+  free(prefix);
   return y;
 }
 
@@ -882,9 +1464,23 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_MEMO      = 25,
+  MPC_TYPE_PROGRAM   = 26,
+  MPC_TYPE_REGEX     = 27,
+  MPC_TYPE_SPAN      = 28
 };
 
+struct mpc_program_t;
+typedef struct mpc_program_t mpc_program_t;
+
+struct mpc_dfa_t;
+typedef struct mpc_dfa_t mpc_dfa_t;
+
+struct mpc_span_t;
+typedef struct mpc_span_t mpc_span_t;
+
 typedef struct { char *m; } mpc_pdata_fail_t;
 typedef struct { mpc_ctor_t lf; void *x; } mpc_pdata_lift_t;
 typedef struct { mpc_parser_t *x; char *m; } mpc_pdata_expect_t;
@@ -896,6 +1492,10 @@ typedef struct { char *x; } mpc_pdata_string_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
+typedef struct { mpc_parser_t *x; mpc_apply_t cp; mpc_dtor_t dx; mpc_sizeof_t sz; } mpc_pdata_memo_t;
+typedef struct { mpc_program_t *x; } mpc_pdata_program_t;
+typedef struct { mpc_parser_t *x; mpc_dfa_t *d; } mpc_pdata_regex_t;
+typedef struct { mpc_parser_t *x; mpc_span_t *s; } mpc_pdata_span_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
@@ -913,6 +1513,10 @@ typedef union {
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_program_t program;
+  mpc_pdata_regex_t regex;
+  mpc_pdata_span_t span;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
@@ -938,64 +1542,1586 @@ static mpc_val_t *mpcf_input_trd_free(mpc_input_t *i, int n, mpc_val_t **xs) { r
 
 static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
   int j;
-  size_t l = 0;
+  size_t l = 0, k, m;
+  char *x;
   if (n == 0) { return mpc_calloc(i, 1, 1); }
   for (j = 0; j < n; j++) { l += strlen(xs[j]); }
+  /* parts piled on top of the arena are popped and joined where they lie */
+  if (mpc_arena_stacked(i, n, xs)) {
+    for (j = n-1; j > 0; j--) { mpc_free(i, xs[j]); }
+    x = mpc_realloc(i, xs[0], l + 1);
+    k = strlen(x);
+    for (j = 1; j < n; j++) {
+      m = strlen(xs[j]);
+      memmove(x + k, xs[j], m);
+      k += m;
+    }
+    x[k] = '\0';
+    return x;
+  }
   xs[0] = mpc_realloc(i, xs[0], l + 1);
-  for (j = 1; j < n; j++) { strcat(xs[0], xs[j]); mpc_free(i, xs[j]); }
+  for (j = 1; j < n; j++) { strcat(xs[0], xs[j]); }
+  for (j = n-1; j > 0; j--) { mpc_free(i, xs[j]); }
   return xs[0];
 }
 
-static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
-  mpc_state_t *s = ((mpc_state_t**)xs)[0];
-  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
-  a = mpc_ast_state(a, *s);
-  mpc_free(i, s);
-  (void) n;
-  return a;
+static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+  mpc_state_t *s = ((mpc_state_t**)xs)[0];
+  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
+  a = mpc_ast_state(a, *s);
+  mpc_free(i, s);
+  (void) n;
+  return a;
+}
+
+static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
+  int j;
+  if (f == mpcf_null)      { return mpcf_null(n, xs); }
+  if (f == mpcf_fst)       { return mpcf_fst(n, xs); }
+  if (f == mpcf_snd)       { return mpcf_snd(n, xs); }
+  if (f == mpcf_trd)       { return mpcf_trd(n, xs); }
+  if (f == mpcf_fst_free)  { return mpcf_input_fst_free(i, n, xs); }
+  if (f == mpcf_snd_free)  { return mpcf_input_snd_free(i, n, xs); }
+  if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
+  if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
+  if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  /* newest first, so each copy can give its block back */
+  for (j = n-1; j >= 0; j--) { xs[j] = mpc_export(i, xs[j]); }
+  return f(n, xs);
+}
+
+static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
+  mpc_free(i, x);
+  return NULL;
+}
+
+static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
+  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_free(i, c);
+  return a;
+}
+
+static mpc_val_t *mpcf_input_str_ast_arena(mpc_input_t *i, mpc_val_t *c) {
+  mpc_ast_t *a;
+  if (!i->ast_arena) { i->ast_arena = mpc_ast_arena_new(); }
+  a = mpc_ast_arena_node(i->ast_arena, "", c, (long)strlen(c));
+  mpc_free(i, c);
+  return a;
+}
+
+/*
+** Run straight after the token is matched, so
+** it ends at the cursor. If the input is there
+** to point into, and the token really is what
+** is behind the cursor, the leaf is a view of
+** it, otherwise it falls back to a copy.
+*/
+
+static mpc_val_t *mpcf_input_str_ast_span(mpc_input_t *i, mpc_val_t *c) {
+  
+  mpc_ast_t *a;
+  long n = (long)strlen(c);
+  
+  if (i->type != MPC_INPUT_STRING || i->state.pos < n
+  ||  memcmp(i->string + i->state.pos - n, c, (size_t)n) != 0) {
+    return mpcf_input_str_ast_arena(i, c);
+  }
+  
+  if (!i->ast_arena) { i->ast_arena = mpc_ast_arena_new(); }
+  
+  a = mpc_ast_arena_node(i->ast_arena, "", "", 0);
+  a->contents = (char*)(i->string + i->state.pos - n);
+  a->contents_len = n;
+  i->ast_arena->spans = 1;
+  mpc_free(i, c);
+  return a;
+}
+
+static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
+  if (f == mpcf_free)     { return mpcf_input_free(i, x); }
+  if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (f == mpcf_str_ast_arena) { return mpcf_input_str_ast_arena(i, x); }
+  if (f == mpcf_str_ast_span)  { return mpcf_input_str_ast_span(i, x); }
+  return f(mpc_export(i, x));
+}
+
+static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  return f(mpc_export(i, x), d);
+}
+
+static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
+  if (d == free) { mpc_free(i, x); return; }
+  d(mpc_export(i, x));
+}
+
+/*
+** Memoization
+*/
+
+/*
+** Parsers wrapped with `mpc_memo` record what
+** happened each time they are run from some
+** position - the state they reached and the
+** errors they reported. If the input is rewound
+** and the same parser is tried again at that
+** position a failure is simply replayed. This
+** is packrat parsing and keeps grammars that
+** retry a rule many times from one position
+** from going exponential.
+**
+** Outputs are owned by whoever receives them,
+** so a success has to be kept as a copy. Most
+** successes are never asked for again, so the
+** first repeat runs the parser once more and
+** only then saves a copy to hand out after.
+** Each hit hands out another copy, which for
+** trees in an arena shares all but the nodes
+** the folds may still change.
+**
+** The table along with the outputs and errors
+** it keeps never holds more than
+** `MPC_MEMO_BUDGET` bytes. A success that will
+** not fit is not saved, and is run again when
+** next asked for. Nothing can be rewound to
+** before the oldest mark, so when the table is
+** full or over budget, entries from before it
+** are dropped, and if that leaves it over a
+** quarter full or the rest of the budget over
+** half used, the whole table is cleared.
+*/
+
+static int mpc_memo_flags(mpc_input_t *i) {
+  return (i->suppress > 0) | ((i->backtrack > 0) << 1);
+}
+
+static size_t mpc_memo_hash(const void *p, long pos, int flags) {
+  size_t h = (size_t)p / sizeof(void*);
+  h = h * 31 + (size_t)pos;
+  h = h * 31 + (size_t)flags;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6dUL;
+  h ^= h >> 12;
+  return h;
+}
+
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, const void *p, long pos, int flags) {
+  
+  size_t j;
+  
+  if (i->memo_slots == 0) { return NULL; }
+  
+  j = mpc_memo_hash(p, pos, flags) & (i->memo_slots - 1);
+  while (i->memo[j].p) {
+    if (i->memo[j].p == p
+    &&  i->memo[j].pos == pos
+    &&  i->memo[j].flags == flags) { return &i->memo[j]; }
+    j = (j + 1) & (i->memo_slots - 1);
+  }
+  
+  return NULL;
+}
+
+static void mpc_memo_release(mpc_input_t *i, mpc_memo_t *m) {
+  i->memo_bytes -= m->bytes;
+  if (m->output) { m->dx(m->output); }
+  if (m->error)  { mpc_err_delete(m->error); }
+  if (m->merged) { mpc_err_delete(m->merged); }
+}
+
+static void mpc_memo_rehash(mpc_input_t *i, size_t slots, long keep) {
+  
+  mpc_memo_t *memo = i->memo;
+  size_t j, k, n = i->memo_slots;
+  
+  i->memo = calloc(slots, sizeof(mpc_memo_t));
+  i->memo_slots = slots;
+  i->memo_num = 0;
+  
+  for (j = 0; j < n; j++) {
+    if (!memo[j].p) { continue; }
+    if (memo[j].pos < keep) { mpc_memo_release(i, &memo[j]); continue; }
+    k = mpc_memo_hash(memo[j].p, memo[j].pos, memo[j].flags) & (slots - 1);
+    while (i->memo[k].p) { k = (k + 1) & (slots - 1); }
+    i->memo[k] = memo[j];
+    i->memo_num++;
+  }
+  
+  free(memo);
+}
+
+/* the bytes held by the table and everything in it */
+static size_t mpc_memo_used(mpc_input_t *i) {
+  return i->memo_slots * sizeof(mpc_memo_t) + i->memo_bytes;
+}
+
+static mpc_memo_t *mpc_memo_insert(mpc_input_t *i, const void *p, long pos, int flags, size_t bytes) {
+  
+  long keep = i->marks_num > 0 && i->marks[0].pos < pos ? i->marks[0].pos : pos;
+  size_t j, slots = i->memo_slots;
+  int full = 2 * (i->memo_num + 1) > i->memo_slots;
+  
+  if (full || mpc_memo_used(i) + bytes > MPC_MEMO_BUDGET) {
+    
+    if (slots == 0) {
+      slots = MPC_MEMO_SLOTS_MIN;
+    } else if (full && mpc_memo_used(i) + slots * sizeof(mpc_memo_t) <= MPC_MEMO_BUDGET) {
+      slots = 2 * slots;
+    }
+    
+    mpc_memo_rehash(i, slots, keep);
+    
+    if (4 * i->memo_num > i->memo_slots
+    ||  2 * (i->memo_bytes + bytes) + i->memo_slots * sizeof(mpc_memo_t) > MPC_MEMO_BUDGET) {
+      mpc_memo_rehash(i, slots, LONG_MAX);
+    }
+  }
+  
+  j = mpc_memo_hash(p, pos, flags) & (i->memo_slots - 1);
+  while (i->memo[j].p) { j = (j + 1) & (i->memo_slots - 1); }
+  
+  i->memo_num++;
+  i->memo_bytes += bytes;
+  i->memo[j].p = p;
+  i->memo[j].pos = pos;
+  i->memo[j].flags = flags;
+  i->memo[j].bytes = bytes;
+  return &i->memo[j];
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  size_t j;
+  for (j = 0; j < i->memo_slots; j++) {
+    if (i->memo[j].p) { mpc_memo_release(i, &i->memo[j]); }
+  }
+  free(i->memo);
+  i->memo = NULL;
+  i->memo_slots = 0;
+  i->memo_num = 0;
+  i->memo_bytes = 0;
+}
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+
+/*
+** Replays what happened the last time `p` was
+** run here, or returns -1 if it has to be run.
+*/
+
+static int mpc_memo_replay(mpc_input_t *i, const void *p, mpc_pdata_memo_t *d, long pos, int flags, mpc_result_t *r, mpc_err_t **e) {
+  
+  mpc_memo_t *m = mpc_memo_find(i, p, pos, flags);
+  
+  if (!m || m->success == MPC_MEMO_UNSAVED) { return -1; }
+  
+  i->state = m->state;
+  i->last = m->last;
+  if (m->merged) { *e = mpc_err_merge(i, *e, mpc_err_copy(m->merged)); }
+  if (m->success == MPC_MEMO_SAVED) {
+    r->output = m->output ? d->cp(m->output) : NULL;
+    return 1;
+  }
+  r->error = m->error ? mpc_err_copy(m->error) : NULL;
+  return 0;
+}
+
+/*
+** Records the outcome of running `p` from `pos`,
+** where `f` holds the errors the run merged.
+*/
+
+static void mpc_memo_record(mpc_input_t *i, const void *p, mpc_pdata_memo_t *d, long pos, int flags, int x, mpc_result_t *r, mpc_err_t *f) {
+  
+  /* the run may have moved the table */
+  mpc_memo_t *m = mpc_memo_find(i, p, pos, flags);
+  mpc_err_t *error, *merged;
+  size_t bytes;
+  
+  if (m && x) {
+    bytes = r->output ? d->sz(r->output) : 0;
+    if (mpc_memo_used(i) + bytes > MPC_MEMO_BUDGET) { return; }
+    m->success = MPC_MEMO_SAVED;
+    m->output = r->output ? d->cp(r->output) : NULL;
+    m->bytes += bytes;
+    i->memo_bytes += bytes;
+  } else if (!m) {
+    error = !x && r->error ? mpc_err_copy(r->error) : NULL;
+    merged = f ? mpc_err_copy(f) : NULL;
+    bytes = (error ? mpc_err_size(error) : 0) + (merged ? mpc_err_size(merged) : 0);
+    m = mpc_memo_insert(i, p, pos, flags, bytes);
+    m->success = x ? MPC_MEMO_UNSAVED : MPC_MEMO_FAILED;
+    m->state = i->state;
+    m->last = i->last;
+    m->output = NULL;
+    m->dx = d->dx;
+    m->error = error;
+    m->merged = merged;
+  }
+}
+
+static int mpc_parse_memo(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  long pos = i->state.pos;
+  int flags = mpc_memo_flags(i);
+  mpc_err_t *f = NULL;
+  int x = mpc_memo_replay(i, p, &p->data.memo, pos, flags, r, e);
+  
+  if (x >= 0) { return x; }
+  
+  /* errors merged by the run are collected separately so they can be replayed */
+  x = mpc_parse_run(i, p->data.memo.x, r, &f);
+  if (x) { r->output = mpc_export(i, r->output); }
+  
+  mpc_memo_record(i, p, &p->data.memo, pos, flags, x, r, f);
+  
+  *e = mpc_err_merge(i, *e, f);
+  return x;
+}
+
+/*
+** Character Spans
+*/
+
+/*
+** Runs like `mpc_many(mpcf_strfold, mpc_digit())`
+** are a call, a mark and an allocation per char
+** with a fold at the end. `mpc_optimise` swaps
+** them for a span, which scans for the end of
+** the run in one go, many bytes at a time, and
+** then copies it out as a single string.
+**
+** The class is kept as a few ranges of `char`
+** so a vector of bytes can be tested with just
+** a pair of compares per range. Errors are the
+** same ones the loop would have given, as they
+** only depend on where the run stops.
+*/
+
+enum {
+  MPC_SPAN_RANGES_MAX = 8
+};
+
+struct mpc_span_t {
+  int many1;
+  int num;
+  char lo[MPC_SPAN_RANGES_MAX];
+  char hi[MPC_SPAN_RANGES_MAX];
+  char *expected;
+};
+
+/* the same tests the primitives make, so `char` signedness agrees too */
+static int mpc_span_member(mpc_parser_t *p, char c) {
+  int j;
+  switch (p->type) {
+    case MPC_TYPE_ANY:    return 1;
+    case MPC_TYPE_SINGLE: return c == p->data.single.x;
+    case MPC_TYPE_RANGE:  return c >= p->data.range.x && c <= p->data.range.y;
+    case MPC_TYPE_ONEOF:  return strchr(p->data.string.x, c) != 0;
+    case MPC_TYPE_NONEOF: return strchr(p->data.string.x, c) == 0;
+    case MPC_TYPE_EXPECT: return mpc_span_member(p->data.expect.x, c);
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (mpc_span_member(p->data.or.xs[j], c)) { return 1; }
+      }
+      return 0;
+    default: return 0;
+  }
+}
+
+/*
+** Checks `p` matches a single char from a set
+** and fails with nothing else to say. An `or`
+** would merge what each alternative expected,
+** so it has to sit inside an `expect`.
+*/
+
+static int mpc_span_class(mpc_parser_t *p, int expected) {
+  int j;
+  if (p->retained) { return 0; }
+  switch (p->type) {
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      return 1;
+    case MPC_TYPE_EXPECT:
+      return mpc_span_class(p->data.expect.x, 1);
+    case MPC_TYPE_OR:
+      if (!expected) { return 0; }
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_span_class(p->data.or.xs[j], 1)) { return 0; }
+      }
+      return 1;
+    default: return 0;
+  }
+}
+
+static mpc_span_t *mpc_span_new(mpc_parser_t *p) {
+
+  mpc_span_t *s;
+  mpc_parser_t *x;
+  int c, in, was = 0;
+
+  if ((p->type != MPC_TYPE_MANY && p->type != MPC_TYPE_MANY1)
+  ||  p->data.repeat.f != mpcf_strfold) { return NULL; }
+
+  x = p->data.repeat.x;
+  if (!mpc_span_class(x, 0)) { return NULL; }
+
+  s = malloc(sizeof(mpc_span_t));
+  s->many1 = p->type == MPC_TYPE_MANY1;
+  s->num = 0;
+
+  for (c = CHAR_MIN; c <= CHAR_MAX; c++) {
+    in = mpc_span_member(x, (char)c);
+    if (in && !was) {
+      if (s->num == MPC_SPAN_RANGES_MAX) { free(s); return NULL; }
+      s->lo[s->num++] = (char)c;
+    }
+    if (in) { s->hi[s->num-1] = (char)c; }
+    was = in;
+  }
+
+  s->expected = NULL;
+  if (x->type == MPC_TYPE_EXPECT) {
+    s->expected = malloc(strlen(x->data.expect.m) + 1);
+    strcpy(s->expected, x->data.expect.m);
+  }
+
+  return s;
+}
+
+static mpc_span_t *mpc_span_copy(mpc_span_t *s) {
+  mpc_span_t *t = malloc(sizeof(mpc_span_t));
+  memcpy(t, s, sizeof(mpc_span_t));
+  if (s->expected) {
+    t->expected = malloc(strlen(s->expected) + 1);
+    strcpy(t->expected, s->expected);
+  }
+  return t;
+}
+
+static void mpc_span_delete(mpc_span_t *s) {
+  free(s->expected);
+  free(s);
+}
+
+static int mpc_span_has(mpc_span_t *s, char c) {
+  int j;
+  for (j = 0; j < s->num; j++) {
+    if (c >= s->lo[j] && c <= s->hi[j]) { return 1; }
+  }
+  return 0;
+}
+
+static long mpc_span_scan_scalar(mpc_span_t *s, const char *x, long n) {
+  long j;
+  for (j = 0; j < n; j++) {
+    if (!mpc_span_has(s, x[j])) { break; }
+  }
+  return j;
+}
+
+/*
+** The vector scans test a register of bytes
+** against every range, and fall back to the
+** scalar scan for the tail. The best kernel
+** the CPU supports is picked on first use.
+*/
+
+#ifdef MPC_SIMD_X86
+
+enum { MPC_SIMD_NONE, MPC_SIMD_SSE2, MPC_SIMD_AVX2 };
+
+static int mpc_simd_level(void) {
+  static int level = -1;
+  if (level < 0) {
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? MPC_SIMD_AVX2 :
+            __builtin_cpu_supports("sse2") ? MPC_SIMD_SSE2 :
+            MPC_SIMD_NONE;
+  }
+  return level;
+}
+
+__attribute__((target("sse2")))
+static long mpc_span_scan_sse2(mpc_span_t *s, const char *x, long n) {
+  __m128i lo[MPC_SPAN_RANGES_MAX], hi[MPC_SPAN_RANGES_MAX], v, out;
+  long j;
+  int k, m;
+  for (k = 0; k < s->num; k++) {
+    lo[k] = _mm_set1_epi8(s->lo[k]);
+    hi[k] = _mm_set1_epi8(s->hi[k]);
+  }
+  for (j = 0; j + 16 <= n; j += 16) {
+    v = _mm_loadu_si128((const __m128i*)(x + j));
+    out = _mm_set1_epi8(-1);
+    for (k = 0; k < s->num; k++) {
+      out = _mm_and_si128(out, _mm_or_si128(
+        _mm_cmplt_epi8(v, lo[k]), _mm_cmpgt_epi8(v, hi[k])));
+    }
+    m = _mm_movemask_epi8(out);
+    if (m) { return j + __builtin_ctz((unsigned)m); }
+  }
+  return j + mpc_span_scan_scalar(s, x + j, n - j);
+}
+
+__attribute__((target("avx2")))
+static long mpc_span_scan_avx2(mpc_span_t *s, const char *x, long n) {
+  __m256i lo[MPC_SPAN_RANGES_MAX], hi[MPC_SPAN_RANGES_MAX], v, out;
+  long j;
+  int k, m;
+  for (k = 0; k < s->num; k++) {
+    lo[k] = _mm256_set1_epi8(s->lo[k]);
+    hi[k] = _mm256_set1_epi8(s->hi[k]);
+  }
+  for (j = 0; j + 32 <= n; j += 32) {
+    v = _mm256_loadu_si256((const __m256i*)(x + j));
+    out = _mm256_set1_epi8(-1);
+    for (k = 0; k < s->num; k++) {
+      out = _mm256_and_si256(out, _mm256_or_si256(
+        _mm256_cmpgt_epi8(lo[k], v), _mm256_cmpgt_epi8(v, hi[k])));
+    }
+    m = _mm256_movemask_epi8(out);
+    if (m) { return j + __builtin_ctz((unsigned)m); }
+  }
+  return j + mpc_span_scan_scalar(s, x + j, n - j);
+}
+
+#endif
+
+static long mpc_span_scan(mpc_span_t *s, const char *x, long n) {
+#ifdef MPC_SIMD_X86
+  switch (mpc_simd_level()) {
+    case MPC_SIMD_AVX2: return mpc_span_scan_avx2(s, x, n);
+    case MPC_SIMD_SSE2: return mpc_span_scan_sse2(s, x, n);
+    default: break;
+  }
+#endif
+  return mpc_span_scan_scalar(s, x, n);
+}
+
+/* moves the cursor past the `n` chars at `x` */
+static void mpc_input_advance(mpc_input_t *i, const char *x, long n) {
+
+  const char *y = x, *z;
+
+  if (n == 0) { return; }
+
+  i->last = x[n-1];
+  i->state.pos += n;
+
+  while ((z = memchr(y, '\n', (size_t)(x + n - y)))) {
+    i->state.row++;
+    y = z + 1;
+  }
+
+  i->state.col = y == x ? i->state.col + n : (x + n) - y;
+}
+
+/*
+** Consumes the run at the cursor, which for a
+** pipe may go on past what is buffered. NULs
+** are dropped from the output, just as folding
+** their empty strings would.
+*/
+
+static long mpc_input_span(mpc_input_t *i, mpc_span_t *s, char **o) {
+
+  const char *x;
+  long n, k, total = 0;
+  size_t len = 0, j;
+  int nul = mpc_span_has(s, '\0');
+
+  *o = mpc_malloc(i, 1);
+
+  while (1) {
+
+    if (i->type == MPC_INPUT_STRING) {
+      x = i->string + i->state.pos;
+      n = (long)i->length - i->state.pos;
+    } else {
+      if (!mpc_input_buffer_fill(i)) { break; }
+      x = i->buffer + (i->state.pos - i->buffer_pos);
+      n = i->buffer_pos + (long)i->buffer_num - i->state.pos;
+    }
+
+    k = mpc_span_scan(s, x, n);
+
+    if (k > 0) {
+      *o = mpc_realloc(i, *o, len + (size_t)k + 1);
+      if (nul) {
+        for (j = 0; j < (size_t)k; j++) {
+          if (x[j]) { (*o)[len++] = x[j]; }
+        }
+      } else {
+        memcpy(*o + len, x, (size_t)k);
+        len += (size_t)k;
+      }
+      mpc_input_advance(i, x, k);
+      total += k;
+    }
+
+    if (k < n || i->type == MPC_INPUT_STRING) { break; }
+  }
+
+  (*o)[len] = '\0';
+  return total;
+}
+
+static int mpc_span_run(mpc_input_t *i, mpc_span_t *s, mpc_result_t *r, mpc_err_t **e) {
+
+  mpc_err_t *err;
+  long n = mpc_input_span(i, s, (char**)&r->output);
+
+  /* what the char parser reports failing where the run stops */
+  err = s->expected ? mpc_err_new(i, s->expected) : NULL;
+
+  if (n == 0 && s->many1) {
+    mpc_free(i, r->output);
+    r->error = mpc_err_many1(i, err);
+    return 0;
+  }
+
+  if (err) { *e = mpc_err_merge(i, *e, err); }
+  return 1;
+}
+
+/*
+** Regular Expression Automata
+*/
+
+/*
+** `mpc_re` builds a tree of combinators, which
+** is run a char at a time with a mark, a fold
+** and an allocation at each step. Most of the
+** expressions found in grammars never really
+** need to backtrack though. At each step the
+** next char decides which way to go, and if
+** some optional part fails half way the match
+** can only fall back to where it started.
+**
+** These are compiled to a DFA with one state
+** per char of the expression (the Glushkov
+** construction). It is run in one pass, and
+** the match ends at the last accepting state
+** seen before it gets stuck.
+**
+** The DFA is only built when it is certain to
+** agree with the tree. The automaton must be
+** deterministic, loops must not match empty,
+** and only the last alternative of an `or` may
+** match empty, because `or` takes the first
+** alternative that succeeds even when a later
+** one would go further. A `count` that fails
+** part way doesn't rewind either, so it must
+** sit inside an `and`, which does.
+**
+** Bytes that no part of the expression tells
+** apart share a class, so each state needs one
+** table entry per class rather than per byte.
+**
+** The tree still runs when errors are wanted,
+** as only it knows what was expected where -
+** a match that succeeds still merges what it
+** expected next into any later error - or when
+** backtracking is disabled. Errors are only
+** suppressed inside `mpc_expect` and `mpc_not`,
+** so in `mpca_lang` the DFA is used for rules
+** given a display name, and not otherwise.
+*/
+
+enum {
+  MPC_DFA_POSITIONS_MAX = 1024
+};
+
+struct mpc_dfa_t {
+  int states;
+  int classes;
+  unsigned char class[256];
+  char *accept;
+  int *trans;
+};
+
+typedef struct {
+  int num;
+  int slots;
+  int *xs;
+} mpc_dfa_list_t;
+
+typedef struct {
+  int nullable;
+  int partial;
+  mpc_dfa_list_t first;
+  mpc_dfa_list_t last;
+} mpc_dfa_frag_t;
+
+typedef struct {
+  int num;
+  int slots;
+  unsigned char (*sets)[32];
+  mpc_dfa_list_t *follow;
+} mpc_dfa_builder_t;
+
+static void mpc_dfa_list_add(mpc_dfa_list_t *l, int x) {
+  int j;
+  for (j = 0; j < l->num; j++) { if (l->xs[j] == x) { return; } }
+  if (l->num == l->slots) {
+    l->slots = l->slots ? 2 * l->slots : 4;
+    l->xs = realloc(l->xs, sizeof(int) * l->slots);
+  }
+  l->xs[l->num++] = x;
+}
+
+static void mpc_dfa_list_append(mpc_dfa_list_t *l, mpc_dfa_list_t *m) {
+  int j;
+  for (j = 0; j < m->num; j++) { mpc_dfa_list_add(l, m->xs[j]); }
+}
+
+static void mpc_dfa_frag_init(mpc_dfa_frag_t *f, int nullable) {
+  f->nullable = nullable;
+  f->partial = 0;
+  f->first.num = f->first.slots = 0;
+  f->first.xs = NULL;
+  f->last.num = f->last.slots = 0;
+  f->last.xs = NULL;
+}
+
+static void mpc_dfa_frag_free(mpc_dfa_frag_t *f) {
+  free(f->first.xs);
+  free(f->last.xs);
+}
+
+static int mpc_dfa_member(mpc_dfa_builder_t *b, int x, int c) {
+  return (b->sets[x][c / 8] >> (c % 8)) & 1;
+}
+
+static int mpc_dfa_position(mpc_dfa_builder_t *b, mpc_parser_t *p, mpc_dfa_frag_t *f) {
+
+  int j, x;
+
+  if (b->num == MPC_DFA_POSITIONS_MAX) { return 0; }
+
+  if (b->num == b->slots) {
+    b->slots = b->slots ? 2 * b->slots : 16;
+    b->sets = realloc(b->sets, sizeof(*b->sets) * b->slots);
+    b->follow = realloc(b->follow, sizeof(mpc_dfa_list_t) * b->slots);
+  }
+
+  x = b->num++;
+  memset(b->sets[x], 0, sizeof(b->sets[x]));
+  b->follow[x].num = b->follow[x].slots = 0;
+  b->follow[x].xs = NULL;
+
+  /*
+  ** NUL is left out, as `strchr` finds the
+  ** terminator and so would make every set
+  ** overlap. The tree handles the odd NUL
+  ** read from a pipe.
+  */
+  for (j = 1; j < 256; j++) {
+    if (mpc_span_member(p, (char)j)) {
+      b->sets[x][j / 8] |= 1 << (j % 8);
+    }
+  }
+
+  mpc_dfa_list_add(&f->first, x);
+  mpc_dfa_list_add(&f->last, x);
+  return 1;
+}
+
+/* appends `g` to the sequence `f` */
+static void mpc_dfa_frag_cat(mpc_dfa_builder_t *b, mpc_dfa_frag_t *f, mpc_dfa_frag_t *g) {
+
+  int j;
+
+  for (j = 0; j < f->last.num; j++) {
+    mpc_dfa_list_append(&b->follow[f->last.xs[j]], &g->first);
+  }
+
+  if (f->nullable) { mpc_dfa_list_append(&f->first, &g->first); }
+  if (!g->nullable) { f->last.num = 0; }
+  mpc_dfa_list_append(&f->last, &g->last);
+  f->nullable = f->nullable && g->nullable;
+}
+
+/*
+** Works out the first and last chars of `p`,
+** adding the ways to get between them to the
+** builder, or returns 0 if `p` can't be run
+** as a DFA. `f` must be freed either way.
+*/
+
+static int mpc_dfa_build(mpc_dfa_builder_t *b, mpc_parser_t *p, mpc_dfa_frag_t *f) {
+
+  mpc_dfa_frag_t g;
+  int j, x = 1;
+
+  mpc_dfa_frag_init(f, 0);
+
+  if (p->retained) { return 0; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      return mpc_dfa_position(b, p, f);
+
+    case MPC_TYPE_EXPECT:
+      return mpc_dfa_build(b, p->data.expect.x, f);
+
+    case MPC_TYPE_SPAN:
+      return mpc_dfa_build(b, p->data.span.x, f);
+
+    case MPC_TYPE_LIFT:
+      f->nullable = 1;
+      return p->data.lift.lf == mpcf_ctor_str;
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      x = mpc_dfa_build(b, p->data.not.x, f) && !f->partial;
+      f->nullable = 1;
+      return x;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      if (!mpc_dfa_build(b, p->data.repeat.x, f) || f->nullable || f->partial) { return 0; }
+      for (j = 0; j < f->last.num; j++) {
+        mpc_dfa_list_append(&b->follow[f->last.xs[j]], &f->first);
+      }
+      f->nullable = p->type == MPC_TYPE_MANY;
+      return 1;
+
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold || p->data.repeat.n < 1) { return 0; }
+      f->nullable = 1;
+      for (j = 0; x && j < p->data.repeat.n; j++) {
+        x = mpc_dfa_build(b, p->data.repeat.x, &g) && !g.partial;
+        if (x) { mpc_dfa_frag_cat(b, f, &g); }
+        mpc_dfa_frag_free(&g);
+      }
+      f->partial = p->data.repeat.n > 1;
+      return x;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold || p->data.and.n < 1) { return 0; }
+      f->nullable = 1;
+      for (j = 0; x && j < p->data.and.n; j++) {
+        x = mpc_dfa_build(b, p->data.and.xs[j], &g);
+        if (x) { mpc_dfa_frag_cat(b, f, &g); }
+        mpc_dfa_frag_free(&g);
+      }
+      return x;
+
+    case MPC_TYPE_OR:
+      if (p->data.or.n < 1) { return 0; }
+      for (j = 0; x && j < p->data.or.n; j++) {
+        x = mpc_dfa_build(b, p->data.or.xs[j], &g);
+        if (g.partial || (g.nullable && j < p->data.or.n-1)) { x = 0; }
+        f->nullable = f->nullable || g.nullable;
+        mpc_dfa_list_append(&f->first, &g.first);
+        mpc_dfa_list_append(&f->last, &g.last);
+        mpc_dfa_frag_free(&g);
+      }
+      return x;
+
+    default: return 0;
+  }
+
+}
+
+/* checks no byte could take a state to two different places */
+static int mpc_dfa_deterministic(mpc_dfa_builder_t *b, mpc_dfa_list_t *l) {
+  int j, k, c;
+  for (j = 0; j < l->num; j++) {
+    for (k = j + 1; k < l->num; k++) {
+      for (c = 0; c < 32; c++) {
+        if (b->sets[l->xs[j]][c] & b->sets[l->xs[k]][c]) { return 0; }
+      }
+    }
+  }
+  return 1;
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *p) {
+
+  mpc_dfa_builder_t b;
+  mpc_dfa_frag_t f;
+  mpc_dfa_list_t *l;
+  mpc_dfa_t *d = NULL;
+  int map[512], reps[256];
+  int j, k, s, c, x;
+
+  b.num = b.slots = 0;
+  b.sets = NULL;
+  b.follow = NULL;
+
+  x = mpc_dfa_build(&b, p, &f) && !f.partial && mpc_dfa_deterministic(&b, &f.first);
+  for (j = 0; x && j < b.num; j++) { x = mpc_dfa_deterministic(&b, &b.follow[j]); }
+
+  if (x) {
+
+    d = malloc(sizeof(mpc_dfa_t));
+    d->states = b.num + 1;
+
+    /* split the bytes into classes by every set in turn */
+    memset(d->class, 0, sizeof(d->class));
+    d->classes = 1;
+    for (j = 0; j < b.num; j++) {
+      for (k = 0; k < 2 * d->classes; k++) { map[k] = -1; }
+      for (k = 0, c = 0; c < 256; c++) {
+        s = 2 * d->class[c] + mpc_dfa_member(&b, j, c);
+        if (map[s] < 0) { map[s] = k++; }
+        d->class[c] = (unsigned char)map[s];
+      }
+      d->classes = k;
+    }
+
+    for (c = 255; c >= 0; c--) { reps[d->class[c]] = c; }
+
+    /* state 0 is the start, and state `j+1` follows the char at position `j` */
+    d->accept = calloc(d->states, 1);
+    d->trans = malloc(sizeof(int) * d->states * d->classes);
+    for (j = 0; j < d->states * d->classes; j++) { d->trans[j] = -1; }
+
+    d->accept[0] = (char)f.nullable;
+    for (j = 0; j < f.last.num; j++) { d->accept[f.last.xs[j] + 1] = 1; }
+
+    for (s = 0; s < d->states; s++) {
+      l = s == 0 ? &f.first : &b.follow[s-1];
+      for (j = 0; j < l->num; j++) {
+        for (k = 0; k < d->classes; k++) {
+          if (mpc_dfa_member(&b, l->xs[j], reps[k])) {
+            d->trans[s * d->classes + k] = l->xs[j] + 1;
+          }
+        }
+      }
+    }
+  }
+
+  mpc_dfa_frag_free(&f);
+  for (j = 0; j < b.num; j++) { free(b.follow[j].xs); }
+  free(b.sets);
+  free(b.follow);
+  return d;
+}
+
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *d) {
+  mpc_dfa_t *e = malloc(sizeof(mpc_dfa_t));
+  memcpy(e, d, sizeof(mpc_dfa_t));
+  e->accept = malloc(d->states);
+  e->trans = malloc(sizeof(int) * d->states * d->classes);
+  memcpy(e->accept, d->accept, d->states);
+  memcpy(e->trans, d->trans, sizeof(int) * d->states * d->classes);
+  return e;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  free(d->accept);
+  free(d->trans);
+  free(d);
+}
+
+
+/* returns -1 when the tree must be run instead */
+static int mpc_dfa_run(mpc_input_t *i, mpc_dfa_t *d, char **o) {
+
+  long start = i->state.pos, base = 0;
+  mpc_state_t end = i->state;
+  char last = i->last, c;
+  const char *s;
+  int x = 0, t, matched = d->accept[0];
+
+  if (i->suppress == 0 || i->backtrack == 0) { return -1; }
+
+  /* keeps what is scanned past the match in the pipe buffer */
+  mpc_input_mark(i);
+
+  while (1) {
+    c = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    if (c == '\0') {
+      mpc_input_rewind(i);
+      return -1;
+    }
+    t = d->trans[x * d->classes + d->class[(unsigned char)c]];
+    if (t < 0) { break; }
+    mpc_input_success(i, c, NULL);
+    x = t;
+    if (d->accept[x]) {
+      matched = 1;
+      end = i->state;
+      last = i->last;
+    }
+  }
+
+  if (!matched) {
+    mpc_input_rewind(i);
+    return 0;
+  }
+
+  i->state = end;
+  i->last = last;
+
+  s = i->string;
+  if (i->type == MPC_INPUT_PIPE) {
+    s = i->buffer;
+    base = i->buffer_pos;
+  }
+  
+  *o = mpc_malloc(i, end.pos - start + 1);
+  memcpy(*o, s + start - base, end.pos - start);
+  (*o)[end.pos - start] = '\0';
+
+  mpc_input_unmark(i);
+  return 1;
+}
+
+/*
+** Compiled Parsers
+*/
+
+/*
+** `mpc_compile` flattens a parser graph into an
+** array of instructions - one per parser that
+** can be reached from the root, which is the
+** first. Children are referred to by index, so
+** the recursion in a grammar just becomes a
+** cycle of indices. Single children are stored
+** in `x`, while the children of `or` and `and`
+** are a run in the shared `kids` array, which
+** `x` is the start of.
+**
+** Instructions are run by a loop which keeps
+** its own stack of frames - one for each
+** instruction waiting on a child - so deeply
+** nested input never recurses on the C stack.
+** The results a frame collects are kept on a
+** second stack. A child always finishes before
+** its parent continues, so the results of each
+** frame sit directly above those of its parent.
+*/
+
+typedef struct {
+  char type;
+  int x;
+  mpc_pdata_t data;
+} mpc_inst_t;
+
+struct mpc_program_t {
+  int n;
+  mpc_inst_t *insts;
+  int kids_num;
+  int *kids;
+};
+
+enum {
+  MPC_PROGRAM_STACK_MIN = 64
+};
+
+static void mpc_program_delete(mpc_program_t *c);
+static mpc_program_t *mpc_program_copy(mpc_program_t *c);
+
+static int mpc_program_children(mpc_parser_t *p, mpc_parser_t ***xs) {
+  switch (p->type) {
+    case MPC_TYPE_APPLY:    *xs = &p->data.apply.x;    return 1;
+    case MPC_TYPE_APPLY_TO: *xs = &p->data.apply_to.x; return 1;
+    case MPC_TYPE_PREDICT:  *xs = &p->data.predict.x;  return 1;
+    case MPC_TYPE_MEMO:     *xs = &p->data.memo.x;     return 1;
+    case MPC_TYPE_REGEX:    *xs = &p->data.regex.x;    return 1;
+    case MPC_TYPE_EXPECT:   *xs = &p->data.expect.x;   return 1;
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:      *xs = &p->data.not.x;      return 1;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:    *xs = &p->data.repeat.x;   return 1;
+    case MPC_TYPE_OR:       *xs = p->data.or.xs;       return p->data.or.n;
+    case MPC_TYPE_AND:      *xs = p->data.and.xs;      return p->data.and.n;
+    default: return 0;
+  }
+}
+
+static char *mpc_program_strdup(const char *s) {
+  char *t = malloc(strlen(s) + 1);
+  strcpy(t, s);
+  return t;
+}
+
+/* gives an instruction its own copy of anything its parser owned */
+static void mpc_program_own(mpc_inst_t *t) {
+
+  mpc_dtor_t *dxs;
+
+  switch (t->type) {
+
+    case MPC_TYPE_FAIL:   t->data.fail.m = mpc_program_strdup(t->data.fail.m);     break;
+    case MPC_TYPE_EXPECT: t->data.expect.m = mpc_program_strdup(t->data.expect.m); break;
+
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      t->data.string.x = mpc_program_strdup(t->data.string.x);
+      break;
+
+    case MPC_TYPE_AND:
+      dxs = NULL;
+      if (t->data.and.n > 1) {
+        dxs = malloc((t->data.and.n-1) * sizeof(mpc_dtor_t));
+        memcpy(dxs, t->data.and.dxs, (t->data.and.n-1) * sizeof(mpc_dtor_t));
+      }
+      t->data.and.xs = NULL;
+      t->data.and.dxs = dxs;
+      break;
+
+    case MPC_TYPE_OR: t->data.or.xs = NULL; break;
+
+    case MPC_TYPE_PROGRAM: t->data.program.x = mpc_program_copy(t->data.program.x); break;
+    case MPC_TYPE_REGEX:   t->data.regex.d = mpc_dfa_copy(t->data.regex.d);         break;
+
+    /* the span has everything it needs, so the loop isn't compiled */
+    case MPC_TYPE_SPAN:
+      t->data.span.x = NULL;
+      t->data.span.s = mpc_span_copy(t->data.span.s);
+      break;
+
+    default: break;
+  }
+
+}
+
+static size_t mpc_program_hash(mpc_parser_t *p) {
+  size_t h = (size_t)p / sizeof(void*);
+  h ^= h >> 15;
+  h *= 0x2c1b3c6dUL;
+  h ^= h >> 12;
+  return h;
+}
+
+/*
+** Returns the index of the instruction for `p`,
+** appending `p` to the parsers still to be
+** compiled if it has not been seen before.
+*/
+
+static int mpc_program_index(mpc_parser_t ***ps, int *n, int **table, int *slots, mpc_parser_t *p) {
+
+  int j, k;
+
+  if (2 * (*n + 1) > *slots) {
+    *slots = *slots ? 2 * *slots : MPC_PROGRAM_STACK_MIN;
+    *table = realloc(*table, sizeof(int) * *slots);
+    *ps = realloc(*ps, sizeof(mpc_parser_t*) * (*slots / 2));
+    for (j = 0; j < *slots; j++) { (*table)[j] = -1; }
+    for (k = 0; k < *n; k++) {
+      j = mpc_program_hash((*ps)[k]) & (*slots - 1);
+      while ((*table)[j] >= 0) { j = (j + 1) & (*slots - 1); }
+      (*table)[j] = k;
+    }
+  }
+
+  j = mpc_program_hash(p) & (*slots - 1);
+  while ((*table)[j] >= 0) {
+    if ((*ps)[(*table)[j]] == p) { return (*table)[j]; }
+    j = (j + 1) & (*slots - 1);
+  }
+
+  (*ps)[*n] = p;
+  (*table)[j] = *n;
+  return (*n)++;
+}
+
+static mpc_program_t *mpc_program_new(mpc_parser_t *a) {
+
+  mpc_program_t *c = malloc(sizeof(mpc_program_t));
+  mpc_parser_t **ps = NULL, **xs;
+  int *table = NULL;
+  int slots = 0, n = 0, j, k, m;
+
+  /* number every reachable parser, breadth first */
+
+  c->kids_num = 0;
+  mpc_program_index(&ps, &n, &table, &slots, a);
+  for (j = 0; j < n; j++) {
+    m = mpc_program_children(ps[j], &xs);
+    if (ps[j]->type == MPC_TYPE_OR || ps[j]->type == MPC_TYPE_AND) { c->kids_num += m; }
+    for (k = 0; k < m; k++) { mpc_program_index(&ps, &n, &table, &slots, xs[k]); }
+  }
+
+  /* and lay them out, looking children up again now every index is known */
+
+  c->n = n;
+  c->insts = malloc(sizeof(mpc_inst_t) * n);
+  c->kids = malloc(sizeof(int) * (c->kids_num ? c->kids_num : 1));
+  c->kids_num = 0;
+
+  for (j = 0; j < n; j++) {
+
+    c->insts[j].type = ps[j]->type;
+    c->insts[j].data = ps[j]->data;
+    c->insts[j].x = -1;
+
+    m = mpc_program_children(ps[j], &xs);
+    if (ps[j]->type == MPC_TYPE_OR || ps[j]->type == MPC_TYPE_AND) {
+      c->insts[j].x = c->kids_num;
+      for (k = 0; k < m; k++) {
+        c->kids[c->kids_num++] = mpc_program_index(&ps, &n, &table, &slots, xs[k]);
+      }
+    } else if (m == 1) {
+      c->insts[j].x = mpc_program_index(&ps, &n, &table, &slots, xs[0]);
+    }
+
+    mpc_program_own(&c->insts[j]);
+  }
+
+  free(ps);
+  free(table);
+  return c;
+}
+
+static mpc_program_t *mpc_program_copy(mpc_program_t *c) {
+
+  mpc_program_t *d = malloc(sizeof(mpc_program_t));
+  int j;
+
+  d->n = c->n;
+  d->kids_num = c->kids_num;
+  d->insts = malloc(sizeof(mpc_inst_t) * c->n);
+  d->kids = malloc(sizeof(int) * (c->kids_num ? c->kids_num : 1));
+  memcpy(d->insts, c->insts, sizeof(mpc_inst_t) * c->n);
+  memcpy(d->kids, c->kids, sizeof(int) * c->kids_num);
+  for (j = 0; j < d->n; j++) { mpc_program_own(&d->insts[j]); }
+
+  return d;
 }
 
-static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
+static void mpc_program_delete(mpc_program_t *c) {
+
   int j;
-  if (f == mpcf_null)      { return mpcf_null(n, xs); }
-  if (f == mpcf_fst)       { return mpcf_fst(n, xs); }
-  if (f == mpcf_snd)       { return mpcf_snd(n, xs); }
-  if (f == mpcf_trd)       { return mpcf_trd(n, xs); }
-  if (f == mpcf_fst_free)  { return mpcf_input_fst_free(i, n, xs); }
-  if (f == mpcf_snd_free)  { return mpcf_input_snd_free(i, n, xs); }
-  if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
-  if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
-  if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
-  for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
-  return f(j, xs);
+  mpc_inst_t *t;
+
+  for (j = 0; j < c->n; j++) {
+    t = &c->insts[j];
+    switch (t->type) {
+      case MPC_TYPE_FAIL:   free(t->data.fail.m);   break;
+      case MPC_TYPE_EXPECT: free(t->data.expect.m); break;
+      case MPC_TYPE_ONEOF:
+      case MPC_TYPE_NONEOF:
+      case MPC_TYPE_STRING: free(t->data.string.x); break;
+      case MPC_TYPE_AND:    free(t->data.and.dxs);  break;
+      case MPC_TYPE_PROGRAM: mpc_program_delete(t->data.program.x); break;
+      case MPC_TYPE_REGEX:   mpc_dfa_delete(t->data.regex.d);         break;
+      case MPC_TYPE_SPAN:    mpc_span_delete(t->data.span.s);         break;
+      default: break;
+    }
+  }
+
+  free(c->insts);
+  free(c->kids);
+  free(c);
 }
 
-static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
-  mpc_free(i, x);
-  return NULL;
+typedef struct {
+  int ip;
+  int j;
+  int err;
+  int results;
+  long pos;
+  int flags;
+  mpc_err_t *f;
+} mpc_frame_t;
+
+typedef struct {
+  mpc_program_t *c;
+  mpc_err_t **e;
+  int frames_num;
+  int frames_slots;
+  mpc_frame_t *frames;
+  int results_num;
+  int results_slots;
+  mpc_result_t *results;
+} mpc_vm_t;
+
+/*
+** Errors are merged into the collection of
+** the nearest enclosing `mpc_memo`, which is
+** stored in its frame, or else into `e`.
+*/
+
+static int mpc_vm_scope(mpc_vm_t *v) {
+  mpc_frame_t *fr;
+  if (v->frames_num == 0) { return -1; }
+  fr = &v->frames[v->frames_num-1];
+  return v->c->insts[fr->ip].type == MPC_TYPE_MEMO ? v->frames_num-1 : fr->err;
 }
 
-static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
-  mpc_free(i, c);
-  return a;
+static mpc_err_t **mpc_vm_errors(mpc_vm_t *v, int k) {
+  return k < 0 ? v->e : &v->frames[k].f;
 }
 
-static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
-  if (f == mpcf_free)     { return mpcf_input_free(i, x); }
-  if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
-  return f(mpc_export(i, x));
+static mpc_frame_t *mpc_vm_push(mpc_vm_t *v, int ip) {
+
+  mpc_frame_t *fr;
+
+  if (v->frames_num == v->frames_slots) {
+    v->frames_slots *= 2;
+    v->frames = realloc(v->frames, sizeof(mpc_frame_t) * v->frames_slots);
+  }
+
+  fr = &v->frames[v->frames_num];
+  fr->ip = ip;
+  fr->j = 0;
+  fr->err = mpc_vm_scope(v);
+  fr->results = v->results_num;
+  fr->f = NULL;
+  v->frames_num++;
+  return fr;
 }
 
-static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
-  return f(mpc_export(i, x), d);
+static void mpc_vm_result(mpc_vm_t *v, mpc_result_t r) {
+  if (v->results_num == v->results_slots) {
+    v->results_slots *= 2;
+    v->results = realloc(v->results, sizeof(mpc_result_t) * v->results_slots);
+  }
+  v->results[v->results_num++] = r;
 }
 
-static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
-  if (d == free) { mpc_free(i, x); return; }
-  d(mpc_export(i, x));
+#define MPC_SUCCESS(y) res.output = y; x = 1; ip = -1; break
+#define MPC_FAILURE(y) res.error = y; x = 0; ip = -1; break
+#define MPC_PRIMITIVE(y) \
+  if (y) { MPC_SUCCESS(res.output); } \
+  else { MPC_FAILURE(NULL); }
+#define MPC_CALL(y) mpc_vm_push(&v, ip); ip = y; break
+
+static int mpc_program_run(mpc_input_t *i, mpc_program_t *c, mpc_result_t *r, mpc_err_t **e) {
+
+  mpc_vm_t v;
+  mpc_frame_t *fr;
+  mpc_inst_t *t;
+  mpc_result_t res;
+  mpc_err_t **errs;
+  int ip = 0, x = 0, k;
+
+  v.c = c;
+  v.e = e;
+  v.frames_num = 0;
+  v.frames_slots = MPC_PROGRAM_STACK_MIN;
+  v.frames = malloc(sizeof(mpc_frame_t) * v.frames_slots);
+  v.results_num = 0;
+  v.results_slots = MPC_PROGRAM_STACK_MIN;
+  v.results = malloc(sizeof(mpc_result_t) * v.results_slots);
+
+  res.output = NULL;
+
+  for (;;) {
+
+    /* Run instructions until one has a result */
+
+    while (ip >= 0) {
+
+      t = &c->insts[ip];
+
+      switch (t->type) {
+
+        case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&res.output));
+        case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, t->data.single.x, (char**)&res.output));
+        case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, t->data.range.x, t->data.range.y, (char**)&res.output));
+        case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, t->data.string.x, (char**)&res.output));
+        case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, t->data.string.x, (char**)&res.output));
+        case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, t->data.satisfy.f, (char**)&res.output));
+        case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, t->data.string.x, (char**)&res.output));
+        case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, t->data.anchor.f, (char**)&res.output));
+
+        case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+        case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+        case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, t->data.fail.m));
+        case MPC_TYPE_LIFT:      MPC_SUCCESS(t->data.lift.lf());
+        case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(t->data.lift.x);
+        case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+
+        case MPC_TYPE_PROGRAM:
+          x = mpc_program_run(i, t->data.program.x, &res, mpc_vm_errors(&v, mpc_vm_scope(&v)));
+          ip = -1;
+          break;
+
+        case MPC_TYPE_SPAN:
+          x = mpc_span_run(i, t->data.span.s, &res, mpc_vm_errors(&v, mpc_vm_scope(&v)));
+          ip = -1;
+          break;
+
+        case MPC_TYPE_REGEX:
+          k = mpc_dfa_run(i, t->data.regex.d, (char**)&res.output);
+          if (k >= 0) { MPC_PRIMITIVE(k); }
+          MPC_CALL(t->x);
+
+        case MPC_TYPE_APPLY:
+        case MPC_TYPE_APPLY_TO:
+        case MPC_TYPE_MAYBE:
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+        case MPC_TYPE_COUNT:
+          MPC_CALL(t->x);
+
+        case MPC_TYPE_EXPECT:
+          mpc_input_suppress_enable(i);
+          MPC_CALL(t->x);
+
+        case MPC_TYPE_PREDICT:
+          mpc_input_backtrack_disable(i);
+          MPC_CALL(t->x);
+
+        case MPC_TYPE_NOT:
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          MPC_CALL(t->x);
+
+        case MPC_TYPE_MEMO:
+          k = mpc_memo_replay(i, t, &t->data.memo, i->state.pos, mpc_memo_flags(i),
+            &res, mpc_vm_errors(&v, mpc_vm_scope(&v)));
+          if (k >= 0) { x = k; ip = -1; break; }
+          fr = mpc_vm_push(&v, ip);
+          fr->pos = i->state.pos;
+          fr->flags = mpc_memo_flags(i);
+          ip = t->x;
+          break;
+
+        case MPC_TYPE_OR:
+          if (t->data.or.n == 0) { MPC_SUCCESS(NULL); }
+          MPC_CALL(c->kids[t->x]);
+
+        case MPC_TYPE_AND:
+          if (t->data.and.n == 0) { MPC_SUCCESS(NULL); }
+          mpc_input_mark(i);
+          MPC_CALL(c->kids[t->x]);
+
+        default:
+          MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+      }
+    }
+
+    /* Hand the result to the frame waiting on it */
+
+    if (v.frames_num == 0) { break; }
+
+    fr = &v.frames[v.frames_num-1];
+    t = &c->insts[fr->ip];
+    errs = mpc_vm_errors(&v, fr->err);
+
+    switch (t->type) {
+
+      case MPC_TYPE_APPLY:
+        if (x) { res.output = mpc_parse_apply(i, t->data.apply.f, res.output); }
+        break;
+
+      case MPC_TYPE_APPLY_TO:
+        if (x) { res.output = mpc_parse_apply_to(i, t->data.apply_to.f, res.output, t->data.apply_to.d); }
+        break;
+
+      case MPC_TYPE_EXPECT:
+        mpc_input_suppress_disable(i);
+        if (!x) { res.error = mpc_err_new(i, t->data.expect.m); }
+        break;
+
+      case MPC_TYPE_PREDICT:
+        mpc_input_backtrack_enable(i);
+        break;
+
+      case MPC_TYPE_MEMO:
+        if (x) { res.output = mpc_export(i, res.output); }
+        mpc_memo_record(i, t, &t->data.memo, fr->pos, fr->flags, x, &res, fr->f);
+        *errs = mpc_err_merge(i, *errs, fr->f);
+        break;
+
+      case MPC_TYPE_NOT:
+        if (x) {
+          mpc_parse_dtor(i, t->data.not.dx, res.output);
+          mpc_input_rewind(i);
+          mpc_input_suppress_disable(i);
+          res.error = mpc_err_new(i, "opposite");
+          x = 0;
+        } else {
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          res.output = t->data.not.lf();
+          x = 1;
+        }
+        break;
+
+      case MPC_TYPE_MAYBE:
+        if (!x) {
+          *errs = mpc_err_merge(i, *errs, res.error);
+          res.output = t->data.not.lf();
+          x = 1;
+        }
+        break;
+
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+      case MPC_TYPE_COUNT:
+        if (x) {
+          mpc_vm_result(&v, res);
+          fr->j++;
+          if (t->type != MPC_TYPE_COUNT || fr->j < t->data.repeat.n) { ip = t->x; continue; }
+          res.output = mpc_parse_fold(i, t->data.repeat.f, fr->j, (mpc_val_t**)(v.results + fr->results));
+        } else if (t->type == MPC_TYPE_COUNT) {
+          for (k = 0; k < fr->j; k++) {
+            mpc_parse_dtor(i, t->data.repeat.dx, v.results[fr->results + k].output);
+          }
+          res.error = mpc_err_count(i, res.error, t->data.repeat.n);
+        } else if (t->type == MPC_TYPE_MANY1 && fr->j == 0) {
+          res.error = mpc_err_many1(i, res.error);
+        } else {
+          *errs = mpc_err_merge(i, *errs, res.error);
+          res.output = mpc_parse_fold(i, t->data.repeat.f, fr->j, (mpc_val_t**)(v.results + fr->results));
+          x = 1;
+        }
+        v.results_num = fr->results;
+        break;
+
+      case MPC_TYPE_OR:
+        if (x) { break; }
+        *errs = mpc_err_merge(i, *errs, res.error);
+        fr->j++;
+        if (fr->j < t->data.or.n) { ip = c->kids[t->x + fr->j]; continue; }
+        res.error = NULL;
+        break;
+
+      case MPC_TYPE_AND:
+        if (x) {
+          mpc_vm_result(&v, res);
+          fr->j++;
+          if (fr->j < t->data.and.n) { ip = c->kids[t->x + fr->j]; continue; }
+          mpc_input_unmark(i);
+          res.output = mpc_parse_fold(i, t->data.and.f, fr->j, (mpc_val_t**)(v.results + fr->results));
+        } else {
+          for (k = 0; k < fr->j; k++) {
+            mpc_parse_dtor(i, t->data.and.dxs[k], v.results[fr->results + k].output);
+          }
+          mpc_input_rewind(i);
+        }
+        v.results_num = fr->results;
+        break;
+
+      default: break;
+    }
+
+    v.frames_num--;
+  }
+
+  free(v.frames);
+  free(v.results);
+  *r = res;
+  return x;
 }
 
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
+#undef MPC_CALL
+
 enum {
   MPC_PARSE_STACK_MIN = 4
 };
@@ -1009,6 +3135,7 @@ enum {
 static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
   
   int j = 0, k = 0;
+  /* scratch that never leaves the call, so kept off the arena */
   mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
   mpc_result_t *results;
   int results_slots = MPC_PARSE_STACK_MIN;
@@ -1071,6 +3198,20 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         MPC_FAILURE(r->error);
       }
     
+    case MPC_TYPE_MEMO:
+      return mpc_parse_memo(i, p, r, e);
+    
+    case MPC_TYPE_PROGRAM:
+      return mpc_program_run(i, p->data.program.x, r, e);
+    
+    case MPC_TYPE_REGEX:
+      j = mpc_dfa_run(i, p->data.regex.d, (char**)&r->output);
+      if (j >= 0) { MPC_PRIMITIVE(j); }
+      return mpc_parse_run(i, p->data.regex.x, r, e);
+    
+    case MPC_TYPE_SPAN:
+      return mpc_span_run(i, p->data.span.s, r, e);
+    
     /* Optional Parsers */
     
     /* TODO: Update Not Error Message */
@@ -1079,9 +3220,9 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       mpc_input_mark(i);
       mpc_input_suppress_enable(i);
       if (mpc_parse_run(i, p->data.not.x, r, e)) {
+        mpc_parse_dtor(i, p->data.not.dx, r->output);
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
         MPC_FAILURE(mpc_err_new(i, "opposite"));
       } else {
         mpc_input_unmark(i);
@@ -1107,18 +3248,18 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         j++;
         if (j == MPC_PARSE_STACK_MIN) {
           results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
+          results = malloc(sizeof(mpc_result_t) * results_slots);
           memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
         } else if (j >= results_slots) {
           results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+          results = realloc(results, sizeof(mpc_result_t) * results_slots);
         }
       }
       
       *e = mpc_err_merge(i, *e, results[j].error);
       MPC_SUCCESS(
         mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        if (j >= MPC_PARSE_STACK_MIN) { free(results); });
     
     case MPC_TYPE_MANY1:
       
@@ -1128,29 +3269,29 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         j++;
         if (j == MPC_PARSE_STACK_MIN) {
           results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
+          results = malloc(sizeof(mpc_result_t) * results_slots);
           memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
         } else if (j >= results_slots) {
           results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+          results = realloc(results, sizeof(mpc_result_t) * results_slots);
         }
       }
       
       if (j == 0) {
         MPC_FAILURE(
           mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          if (j >= MPC_PARSE_STACK_MIN) { free(results); });
       } else {
         *e = mpc_err_merge(i, *e, results[j].error);
         MPC_SUCCESS(
           mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          if (j >= MPC_PARSE_STACK_MIN) { free(results); });
       }
     
     case MPC_TYPE_COUNT:
       
       results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
+        ? malloc(sizeof(mpc_result_t) * p->data.repeat.n)
         : results_stk;
       
       while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
@@ -1161,14 +3302,14 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       if (j == p->data.repeat.n) {
         MPC_SUCCESS(
           mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { free(results); });
       } else {
         for (k = 0; k < j; k++) {
           mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
         }
         MPC_FAILURE(
           mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });  
+          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { free(results); });  
       }
       
     /* Combinatory Parsers */
@@ -1178,44 +3319,44 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
       
       results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
+        ? malloc(sizeof(mpc_result_t) * p->data.or.n)
         : results_stk;
       
       for (j = 0; j < p->data.or.n; j++) {
         if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
           MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+            if (p->data.or.n > MPC_PARSE_STACK_MIN) { free(results); });
         } else {
           *e = mpc_err_merge(i, *e, results[j].error);
         } 
       }
       
       MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        if (p->data.or.n > MPC_PARSE_STACK_MIN) { free(results); });
     
     case MPC_TYPE_AND:
       
       if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
       
       results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
+        ? malloc(sizeof(mpc_result_t) * p->data.or.n)
         : results_stk;
       
       mpc_input_mark(i);
       for (j = 0; j < p->data.and.n; j++) {
         if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
-          mpc_input_rewind(i);
           for (k = 0; k < j; k++) {
             mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
           }
+          mpc_input_rewind(i);
           MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+            if (p->data.or.n > MPC_PARSE_STACK_MIN) { free(results); });
         }
       }
       mpc_input_unmark(i); 
       MPC_SUCCESS(
         mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        if (p->data.or.n > MPC_PARSE_STACK_MIN) { free(results); });
     
     /* End */
     
@@ -1238,10 +3379,21 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e);
   if (x) {
-    mpc_err_delete_internal(i, e);
+    mpc_err_delete(e);
     r->output = mpc_export(i, r->output);
+    if (i->ast_arena && mpc_ast_arena_owns(i->ast_arena, r->output)) {
+      i->ast_arena->root = r->output;
+      /* views into a buffer the input made keep it alive */
+      if (i->ast_arena->spans) {
+        i->ast_arena->owned = i->owned;
+        i->ast_arena->mapped = i->mapped;
+        i->owned = NULL;
+        i->mapped = 0;
+      }
+      i->ast_arena = NULL;
+    }
   } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    r->error = mpc_err_merge(i, e, r->error);
   }
   return x;
 }
@@ -1338,6 +3490,18 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_MEMO:     mpc_undefine_unretained(p->data.memo.x, 0);     break;
+    case MPC_TYPE_PROGRAM:  mpc_program_delete(p->data.program.x);          break;
+    
+    case MPC_TYPE_REGEX:
+      mpc_undefine_unretained(p->data.regex.x, 0);
+      mpc_dfa_delete(p->data.regex.d);
+      break;
+    
+    case MPC_TYPE_SPAN:
+      mpc_undefine_unretained(p->data.span.x, 0);
+      mpc_span_delete(p->data.span.s);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1436,6 +3600,18 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_MEMO:     p->data.memo.x     = mpc_copy(a->data.memo.x);     break;
+    case MPC_TYPE_PROGRAM:  p->data.program.x  = mpc_program_copy(a->data.program.x); break;
+    
+    case MPC_TYPE_REGEX:
+      p->data.regex.x = mpc_copy(a->data.regex.x);
+      p->data.regex.d = mpc_dfa_copy(a->data.regex.d);
+      break;
+    
+    case MPC_TYPE_SPAN:
+      p->data.span.x = mpc_copy(a->data.span.x);
+      p->data.span.s = mpc_span_copy(a->data.span.s);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1726,6 +3902,23 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_apply_t cp, mpc_dtor_t da, mpc_sizeof_t sz) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.cp = cp;
+  p->data.memo.dx = da;
+  p->data.memo.sz = sz;
+  return p;
+}
+
+mpc_parser_t *mpc_compile(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PROGRAM;
+  p->data.program.x = mpc_program_new(a);
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -2156,6 +4349,17 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+static mpc_parser_t *mpc_re_automaton(mpc_parser_t *a) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_new(a);
+  if (!d) { return a; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_REGEX;
+  p->data.regex.x = a;
+  p->data.regex.d = d;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   
   char *err_msg;
@@ -2219,7 +4423,7 @@ mpc_parser_t *mpc_re(const char *re) {
   
   mpc_optimise(r.output);
   
-  return r.output;
+  return mpc_re_automaton(r.output);
   
 }
 
@@ -2560,6 +4764,10 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_print_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_PROGRAM)  { printf("<compiled>"); }
+  if (p->type == MPC_TYPE_REGEX)    { mpc_print_unretained(p->data.regex.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { mpc_print_unretained(p->data.span.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2671,6 +4879,11 @@ void mpc_ast_delete(mpc_ast_t *a) {
   
   if (a == NULL) { return; }
   
+  if (a->arena) {
+    if (a->arena->root == a) { mpc_ast_arena_delete(a->arena); }
+    return;
+  }
+  
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
   }
@@ -2683,30 +4896,109 @@ void mpc_ast_delete(mpc_ast_t *a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
   free(a->tag);
   free(a->contents);
   free(a);
 }
 
-mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+static mpc_ast_t *mpc_ast_new_len(const char *tag, const char *contents, long n) {
   
   mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
   
   a->tag = malloc(strlen(tag) + 1);
   strcpy(a->tag, tag);
   
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
+  a->contents = malloc((size_t)n + 1);
+  memcpy(a->contents, contents, (size_t)n);
+  a->contents[n] = '\0';
+  a->contents_len = n;
   
   a->state = mpc_state_new();
   
   a->children_num = 0;
   a->children = NULL;
+  a->children_slots = 0;
+  a->arena = NULL;
+  a->tag_id = -1;
   return a;
   
 }
 
+mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+  return mpc_ast_new_len(tag, contents, (long)strlen(contents));
+}
+
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  
+  r = mpc_ast_new_len(a->tag, a->contents, mpc_ast_contents_len(a));
+  r->state = a->state;
+  
+  if (a->children_num) {
+    r->children_num = a->children_num;
+    r->children_slots = a->children_num;
+    r->children = malloc(sizeof(mpc_ast_t*) * a->children_num);
+    for (i = 0; i < a->children_num; i++) {
+      r->children[i] = mpc_ast_copy(a->children[i]);
+    }
+  }
+  
+  return r;
+}
+
+/*
+** Nodes in an arena are never freed alone, so
+** `mpca_memo` need not copy a saved tree whole.
+** Folds only change the root they are given and
+** its child if it is an only child, so that run
+** of nodes is copied and the rest is shared.
+*/
+
+static mpc_ast_t *mpc_ast_memo_copy(mpc_ast_t *a) {
+  
+  mpc_ast_t *b;
+  
+  if (a == NULL || a->arena == NULL) { return mpc_ast_copy(a); }
+  
+  b = mpc_ast_arena_malloc(a->arena, sizeof(mpc_ast_t));
+  memcpy(b, a, sizeof(mpc_ast_t));
+  
+  /* adding a child must not write into the shared array */
+  b->children_slots = b->children_num;
+  
+  if (a->children_num == 1) {
+    b->children = mpc_ast_arena_malloc(a->arena, sizeof(mpc_ast_t*));
+    b->children[0] = mpc_ast_memo_copy(a->children[0]);
+  }
+  
+  return b;
+}
+
+/* the bytes `mpc_ast_memo_copy` makes for `a` */
+static size_t mpc_ast_memo_size(mpc_ast_t *a) {
+  
+  int i;
+  size_t n = sizeof(mpc_ast_t);
+  
+  if (a == NULL) { return 0; }
+  
+  if (a->arena) {
+    if (a->children_num == 1) { n += sizeof(mpc_ast_t*) + mpc_ast_memo_size(a->children[0]); }
+    return n;
+  }
+  
+  n += strlen(a->tag) + 1 + strlen(a->contents) + 1;
+  n += sizeof(mpc_ast_t*) * a->children_num;
+  for (i = 0; i < a->children_num; i++) { n += mpc_ast_memo_size(a->children[i]); }
+  return n;
+}
+
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
   
   mpc_ast_t *a = mpc_ast_new(tag, "");
@@ -2733,7 +5025,7 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   if (a->children_num == 0) { return a; }
   if (a->children_num == 1) { return a; }
 
-  r = mpc_ast_new(">", "");
+  r = a->arena ? mpc_ast_arena_node(a->arena, ">", "", 0) : mpc_ast_new(">", "");
   mpc_ast_add_child(r, a);
   return r;
 }
@@ -2743,7 +5035,8 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   int i;
 
   if (strcmp(a->tag, b->tag) != 0) { return 0; }
-  if (strcmp(a->contents, b->contents) != 0) { return 0; }
+  if (mpc_ast_contents_len(a) != mpc_ast_contents_len(b)
+  ||  memcmp(a->contents, b->contents, (size_t)mpc_ast_contents_len(a)) != 0) { return 0; }
   if (a->children_num != b->children_num) { return 0; }
   
   for (i = 0; i < a->children_num; i++) {
@@ -2754,14 +5047,29 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
+  
+  mpc_ast_t **cs;
+  
+  if (r->arena && a && a->arena != r->arena) { a = mpc_ast_arena_adopt(r->arena, a); }
+  
+  if (r->children_num >= r->children_slots) {
+    r->children_slots = r->children_num + r->children_num / 2 + 1;
+    if (r->arena) {
+      cs = mpc_ast_arena_malloc(r->arena, sizeof(mpc_ast_t*) * r->children_slots);
+      if (r->children_num) { memcpy(cs, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+      r->children = cs;
+    } else {
+      r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_slots);
+    }
+  }
+  
+  r->children[r->children_num++] = a;
   return r;
 }
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  if (a->arena) { return mpc_ast_arena_tag_id(a, mpc_ast_arena_join(a->arena, t, 0, a->tag_id)); }
   a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, strlen(t));
@@ -2771,6 +5079,7 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  if (a->arena) { return mpc_ast_arena_tag_id(a, mpc_ast_arena_join(a->arena, t, 1, a->tag_id)); }
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
   memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, (strlen(t)-1));
@@ -2778,6 +5087,7 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  if (a->arena) { return mpc_ast_arena_tag_id(a, mpc_symbols_find(&a->arena->tags, t, 1)); }
   a->tag = realloc(a->tag, strlen(t) + 1);
   strcpy(a->tag, t);
   return a;
@@ -2800,11 +5110,11 @@ static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
   
   for (i = 0; i < d; i++) { fprintf(fp, "  "); }
   
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
+  if (mpc_ast_contents_len(a)) {
+    fprintf(fp, "%s:%lu:%lu '%.*s'\n", a->tag, 
       (long unsigned int)(a->state.row+1),
       (long unsigned int)(a->state.col+1),
-      a->contents);
+      (int)mpc_ast_contents_len(a), a->contents);
   } else {
     fprintf(fp, "%s \n", a->tag);
   }
@@ -2823,15 +5133,24 @@ void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
   mpc_ast_print_depth(a, 0, fp);
 }
 
+int mpc_ast_tag_id(mpc_ast_t *a, const char *t) {
+  return a->arena ? mpc_symbols_find(&a->arena->tags, t, 0) : -1;
+}
+
+/* children in the same arena as `ast` are checked by id alone */
+static int mpc_ast_tag_is(mpc_ast_t *ast, mpc_ast_t *a, const char *tag, int id) {
+  return ast->arena && a->arena == ast->arena ? a->tag_id == id : strcmp(a->tag, tag) == 0;
+}
+
 int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
   return mpc_ast_get_index_lb(ast, tag, 0);
 }
 
 int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
-  int i;
+  int i, id = lb < ast->children_num ? mpc_ast_tag_id(ast, tag) : -1;
 
   for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
+    if(mpc_ast_tag_is(ast, ast->children[i], tag, id)) {
       return i;
     }
   }
@@ -2844,10 +5163,10 @@ mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
 }
 
 mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
-  int i;
+  int i, id = lb < ast->children_num ? mpc_ast_tag_id(ast, tag) : -1;
 
   for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
+    if(mpc_ast_tag_is(ast, ast->children[i], tag, id)) {
       return ast->children[i];
     }
   }
@@ -2991,18 +5310,131 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
   }
 }
 
+/*
+** Flattening makes two passes, one to size the
+** arrays and one to fill them, numbering tags
+** in the order they are first seen.
+*/
+
+typedef struct {
+  mpc_ast_flat_t *f;
+  mpc_symbols_t tags;
+  long text;
+} mpc_ast_flat_st_t;
+
+static void mpc_ast_flat_count(mpc_ast_t *a, int *n, long *m) {
+  int i;
+  (*n)++;
+  *m += mpc_ast_contents_len(a) + 1;
+  for (i = 0; i < a->children_num; i++) {
+    if (a->children[i]) { mpc_ast_flat_count(a->children[i], n, m); }
+  }
+}
+
+static int mpc_ast_flat_fill(mpc_ast_flat_st_t *st, mpc_ast_t *a) {
+
+  mpc_ast_flat_t *f = st->f;
+  int i, j = f->nodes_num++, c, last = -1;
+  long n = mpc_ast_contents_len(a);
+
+  f->tag[j] = mpc_symbols_find(&st->tags, a->tag, 1);
+  f->contents[j] = st->text;
+  f->contents_len[j] = n;
+  memcpy(f->text + st->text, a->contents, (size_t)n);
+  f->text[st->text + n] = '\0';
+  st->text += n + 1;
+  f->state[j] = a->state;
+  f->first_child[j] = -1;
+  f->next_sibling[j] = -1;
+
+  for (i = 0; i < a->children_num; i++) {
+    if (a->children[i] == NULL) { continue; }
+    c = mpc_ast_flat_fill(st, a->children[i]);
+    if (last < 0) { f->first_child[j] = c; } else { f->next_sibling[last] = c; }
+    last = c;
+  }
+
+  return j;
+}
+
+mpc_ast_flat_t *mpc_ast_flatten(mpc_ast_t *a) {
+
+  mpc_ast_flat_st_t st;
+  mpc_ast_flat_t *f;
+  int n = 0;
+  long m = 0;
+
+  if (a == NULL) { return NULL; }
+
+  mpc_ast_flat_count(a, &n, &m);
+
+  f = malloc(sizeof(mpc_ast_flat_t));
+  f->nodes_num = 0;
+  f->text = malloc((size_t)m);
+  f->tag = malloc(sizeof(int) * n);
+  f->contents = malloc(sizeof(long) * n);
+  f->contents_len = malloc(sizeof(long) * n);
+  f->state = malloc(sizeof(mpc_state_t) * n);
+  f->first_child = malloc(sizeof(int) * n);
+  f->next_sibling = malloc(sizeof(int) * n);
+
+  st.f = f;
+  mpc_symbols_init(&st.tags);
+  st.text = 0;
+
+  mpc_ast_flat_fill(&st, a);
+
+  f->tags_num = st.tags.num;
+  f->tags = st.tags.names;
+  free(st.tags.table);
+  return f;
+}
+
+void mpc_ast_flat_delete(mpc_ast_flat_t *f) {
+
+  int i;
+
+  if (f == NULL) { return; }
+
+  for (i = 0; i < f->tags_num; i++) { free(f->tags[i]); }
+  free(f->tags);
+  free(f->text);
+  free(f->tag);
+  free(f->contents);
+  free(f->contents_len);
+  free(f->state);
+  free(f->first_child);
+  free(f->next_sibling);
+  free(f);
+}
+
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   
-  int i, j;
+  int i, j, k = 0;
   mpc_ast_t** as = (mpc_ast_t**)xs;
   mpc_ast_t *r;
+  mpc_ast_arena_t *arena = NULL;
   
   if (n == 0) { return NULL; }
   if (n == 1) { return xs[0]; }
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
   
-  r = mpc_ast_new(">", "");
+  /* sizes the children once, and joins any arena the parts are in */
+  for (i = 0; i < n; i++) {
+    if (as[i] == NULL) { continue; }
+    if (!arena) { arena = as[i]->arena; }
+    k += as[i]->children_num ? as[i]->children_num : 1;
+  }
+  
+  r = arena ? mpc_ast_arena_node(arena, ">", "", 0) : mpc_ast_new(">", "");
+  
+  if (k) {
+    r->children_slots = k;
+    r->children = arena ?
+      mpc_ast_arena_malloc(arena, sizeof(mpc_ast_t*) * k) :
+      malloc(sizeof(mpc_ast_t*) * k);
+  }
   
   for (i = 0; i < n; i++) {
     
@@ -3035,6 +5467,15 @@ mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
   return a;
 }
 
+/* these only get an arena when run by a parser */
+mpc_val_t *mpcf_str_ast_arena(mpc_val_t *c) {
+  return mpcf_str_ast(c);
+}
+
+mpc_val_t *mpcf_str_ast_span(mpc_val_t *c) {
+  return mpcf_str_ast(c);
+}
+
 mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
@@ -3044,6 +5485,12 @@ mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
   return a;
 }
 
+mpc_val_t *mpcf_flat_ast(mpc_val_t *a) {
+  mpc_ast_flat_t *f = mpc_ast_flatten(a);
+  mpc_ast_delete(a);
+  return f;
+}
+
 mpc_parser_t *mpca_state(mpc_parser_t *a) {
   return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
 }
@@ -3060,6 +5507,10 @@ mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
 
+mpc_parser_t *mpca_flat(mpc_parser_t *a) {
+  return mpc_apply(a, mpcf_flat_ast);
+}
+
 mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
 mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
 mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
@@ -3113,6 +5564,9 @@ mpc_parser_t *mpca_and(int n, ...) {
 }
 
 mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_memo(mpc_parser_t *a) {
+  return mpc_memo(a, (mpc_apply_t)mpc_ast_memo_copy, (mpc_dtor_t)mpc_ast_delete, (mpc_sizeof_t)mpc_ast_memo_size);
+}
 
 /*
 ** Grammar Parser
@@ -3193,28 +5647,44 @@ static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
   return mpca_count(num, xs[0]);
 }
 
+/*
+** Leaves that are spans are made before the
+** whitespace after them is skipped, so they
+** can tell where in the input they started.
+*/
+
+static mpc_parser_t *mpcaf_grammar_leaf(mpca_grammar_st_t *st, mpc_parser_t *p, const char *t) {
+  int tok = !(st->flags & MPCA_LANG_WHITESPACE_SENSITIVE);
+  if (st->flags & MPCA_LANG_AST_SPANS) {
+    p = mpc_apply(p, mpcf_str_ast_span);
+    if (tok) { p = mpc_tok(p); }
+  } else {
+    if (tok) { p = mpc_tok(p); }
+    /* memoised trees go in an arena so saved ones can be shared */
+    p = mpc_apply(p, (st->flags & (MPCA_LANG_AST_ARENA | MPCA_LANG_MEMOIZE)) ? mpcf_str_ast_arena : mpcf_str_ast);
+  }
+  return mpca_state(mpca_tag(p, t));
+}
+
 static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
+  mpc_parser_t *p = mpc_string(y);
   free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
+  return mpcaf_grammar_leaf(s, p, "string");
 }
 
 static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
+  mpc_parser_t *p = mpc_char(y[0]);
   free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
+  return mpcaf_grammar_leaf(s, p, "char");
 }
 
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  mpc_parser_t *p = mpc_re(y);
   free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
+  return mpcaf_grammar_leaf(s, p, "regex");
 }
 
 /* Should this just use `isdigit` instead? */
@@ -3349,6 +5819,8 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
   
   mpc_optimise(r.output);
   
+  if (st->flags & MPCA_LANG_MEMOIZE) { r.output = mpca_memo(r.output); }
+  
   return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
   
 }
@@ -3430,6 +5902,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
+    if (st->flags & MPCA_LANG_MEMOIZE) { stmt->grammar = mpca_memo(stmt->grammar); }
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
     free(stmt->name);
@@ -3623,6 +6096,10 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_PROGRAM)  { return p->data.program.x->n; }
+  if (p->type == MPC_TYPE_REGEX)    { return 1 + mpc_nodecount_unretained(p->data.regex.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { return 1 + mpc_nodecount_unretained(p->data.span.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3661,6 +6138,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   
   int i, n, m;
   mpc_parser_t *t;
+  mpc_span_t *s;
   
   if (p->retained && !force) { return; }
   
@@ -3670,6 +6148,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_optimise_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_REGEX)    { mpc_optimise_unretained(p->data.regex.x, 0); }
   if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3713,7 +6193,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       n = p->data.or.n; m = t->data.or.n;
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
+      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
       free(t->data.or.xs); free(t->name); free(t);
       continue;
@@ -3801,6 +6281,19 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
     
+    /* Scan repeated char classes */
+    if ((p->type == MPC_TYPE_MANY || p->type == MPC_TYPE_MANY1)
+    &&  (s = mpc_span_new(p))) {
+      t = malloc(sizeof(mpc_parser_t));
+      memcpy(t, p, sizeof(mpc_parser_t));
+      t->retained = 0;
+      t->name = NULL;
+      p->type = MPC_TYPE_SPAN;
+      p->data.span.x = t;
+      p->data.span.s = s;
+      continue;
+    }
+    
     /* Merge re rhs `and` */
     if (p->type == MPC_TYPE_AND
     &&  p->data.and.f == mpcf_strfold
@@ -64,6 +64,22 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+/*
+** Strings are parsed in place and must outlive
+** the call. `mpc_nparse` stops at `length` or
+** the first NUL, so it can be handed a buffer
+** that is not terminated, such as a mapped file.
+**
+** `mpc_parse_file` maps the file from its current
+** position to the end, or reads it in whole if it
+** cannot be mapped, so the stream is left at EOF.
+**
+** `mpc_parse_pipe` reads the stream's descriptor
+** directly on POSIX systems, taking whatever is
+** available each time, so input already held in
+** the stream's own buffer is not seen.
+*/
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
@@ -80,6 +96,7 @@ typedef mpc_val_t*(*mpc_ctor_t)(void);
 typedef mpc_val_t*(*mpc_apply_t)(mpc_val_t*);
 typedef mpc_val_t*(*mpc_apply_to_t)(mpc_val_t*,void*);
 typedef mpc_val_t*(*mpc_fold_t)(int,mpc_val_t**);
+typedef size_t(*mpc_sizeof_t)(mpc_val_t*);
 
 /*
 ** Building a Parser
@@ -140,6 +157,40 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** `mpc_memo` caches the result of `a` at each
+** position for the rest of the parse. `a` must
+** not depend on anything but the input. `cp`
+** copies an output, `da` deletes one, and `sz`
+** gives the bytes a copy holds, which count
+** towards `MPC_MEMO_BUDGET`.
+**
+** Each cached success hands out a copy made
+** with `cp`, so it costs what `cp` does. Trees
+** from `mpca_memo` copy only the nodes that are
+** still changed when they are in an arena, as
+** they always are with `MPCA_LANG_MEMOIZE`.
+** Trees outside one are copied whole. Once the
+** copies fill the budget the rules they came
+** from are run again each time, and deeply
+** nested input can then take exponential time.
+*/
+
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_apply_t cp, mpc_dtor_t da, mpc_sizeof_t sz);
+
+/*
+** `mpc_compile` flattens everything reachable
+** from `a` into an array of instructions, run
+** with an explicit stack rather than recursion,
+** so deep input cannot overflow the C stack.
+** Best done once the grammar is finished and
+** optimised. `a` is copied, not taken, so it
+** still has to be deleted, and changing it has
+** no effect on the compiled parser.
+*/
+
+mpc_parser_t *mpc_compile(mpc_parser_t *a);
+
 /*
 ** Common Parsers
 */
@@ -255,21 +306,74 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 ** Regular Expression Parsers
 */
 
+/*
+** Expressions that never need to backtrack are
+** also compiled to a DFA. It is only run where
+** errors are suppressed - inside `mpc_expect`,
+** `mpc_not`, or an `mpca_lang` rule given a
+** display name. A bare `mpc_re`, or a regex in
+** an unnamed rule, always runs the combinators,
+** as even a successful match records what was
+** expected next for any later error message.
+*/
 mpc_parser_t *mpc_re(const char *re);
   
 /*
 ** AST
 */
 
+struct mpc_ast_arena_t;
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
 typedef struct mpc_ast_t {
   char *tag;
   char *contents;
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int children_slots;
+  int tag_id;
+  mpc_ast_arena_t *arena;
+  long contents_len;
 } mpc_ast_t;
 
+/*
+** Trees built from `mpcf_str_ast_arena` leaves,
+** as with `MPCA_LANG_AST_ARENA` or
+** `MPCA_LANG_MEMOIZE`, live in a single
+** arena owned by their root. They are freed all
+** at once by calling `mpc_ast_delete` on the root,
+** and deleting any other node in them does nothing.
+**
+** Their tags are interned, and `tag_id` numbers
+** them within the tree, so child lookups compare
+** integers. `mpc_ast_tag_id` gives the number of
+** a tag, or -1 if no node in the tree can have
+** it. Tags should only be changed with the calls
+** below. Nodes outside an arena have a `tag_id`
+** of -1.
+**
+** With `mpcf_str_ast_span` leaves, as with the
+** `MPCA_LANG_AST_SPANS` flag, the tree is also in
+** an arena, and leaves point into the input for
+** their contents rather than copying them. These
+** are `contents_len` chars long with no NUL after
+** them. The string given to `mpc_parse` has to
+** outlive the tree, while buffers mpc reads or
+** maps in itself are kept by the tree. Pipes are
+** still copied, as their buffer moves on.
+**
+** `mpc_ast_add_child` on a node in an arena moves
+** the new child into it in place. Pointers to the
+** child and its children stay valid, they are
+** freed with the tree, and `mpc_ast_delete` on
+** them then does nothing. The exception is a
+** node inside another arena's tree, which is
+** copied, leaving that tree as it was.
+*/
+
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
@@ -282,6 +386,7 @@ void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
 
+int mpc_ast_tag_id(mpc_ast_t *a, const char *t);
 int mpc_ast_get_index(mpc_ast_t *ast, const char *tag);
 int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb);
 mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag);
@@ -311,15 +416,48 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav);
 */
 int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b);
 
+/*
+** A flat copy of a tree, with one array per
+** field indexed by node, laid out in pre-order
+** from the root at 0. Children are reached by
+** `first_child` then `next_sibling`, which are
+** -1 at the ends. Nodes hold the index of their
+** tag in `tags`, and their contents as a span
+** of `text`, where each is also NUL terminated.
+** `mpca_flat` turns the output of a parser into
+** one, so belongs at the top of a grammar.
+*/
+
+typedef struct {
+  int nodes_num;
+  int tags_num;
+  char **tags;
+  char *text;
+  int *tag;
+  long *contents;
+  long *contents_len;
+  mpc_state_t *state;
+  int *first_child;
+  int *next_sibling;
+} mpc_ast_flat_t;
+
+mpc_ast_flat_t *mpc_ast_flatten(mpc_ast_t *a);
+void mpc_ast_flat_delete(mpc_ast_flat_t *f);
+
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **as);
 mpc_val_t *mpcf_str_ast(mpc_val_t *c);
+mpc_val_t *mpcf_str_ast_arena(mpc_val_t *c);
+mpc_val_t *mpcf_str_ast_span(mpc_val_t *c);
 mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs);
+mpc_val_t *mpcf_flat_ast(mpc_val_t *a);
 
 mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t);
 mpc_parser_t *mpca_root(mpc_parser_t *a);
+mpc_parser_t *mpca_flat(mpc_parser_t *a);
 mpc_parser_t *mpca_state(mpc_parser_t *a);
 mpc_parser_t *mpca_total(mpc_parser_t *a);
+mpc_parser_t *mpca_memo(mpc_parser_t *a);
 
 mpc_parser_t *mpca_not(mpc_parser_t *a);
 mpc_parser_t *mpca_maybe(mpc_parser_t *a);
@@ -334,7 +472,10 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_MEMOIZE              = 4,
+  MPCA_LANG_AST_ARENA            = 8,
+  MPCA_LANG_AST_SPANS            = 16
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -5,14 +5,147 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+#if defined(__linux__) && defined(VEC_USE_MMAP)
+#define _GNU_SOURCE
+#define VEC_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <limits.h>
+
 #include "vec.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VEC_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Build flags for vec.c; vec.h does not read them, so they must be given
+ * when compiling this file (e.g. -DVECL_GROWTH_SHIFT=0):
+ *   VECL_GROWTH_SHIFT  vecl_t grows by 1 + 1/2^shift, 0 to 31 (default 1)
+ *   VECL_MIN_CAPACITY  first vecl_t allocation in elements, >= 1 (default 8)
+ *   VECD_MIN_CAPACITY  first vecd_t allocation in elements, a power of two
+ *                      (default 8)
+ *   VEC_USE_MMAP       map large blocks directly on Linux (default off)
+ *   VEC_MMAP_THRESHOLD smallest mapped block in bytes, >= 1 (default 32 MiB) */
+
+#ifndef VECL_GROWTH_SHIFT
+#define VECL_GROWTH_SHIFT 1
+#endif
+
+#ifndef VECL_MIN_CAPACITY
+#define VECL_MIN_CAPACITY 8
+#endif
+
+#ifndef VECD_MIN_CAPACITY
+#define VECD_MIN_CAPACITY 8
+#endif
+
+#ifndef VEC_MMAP_THRESHOLD
+#define VEC_MMAP_THRESHOLD (32L << 20)
+#endif
+
+#if VECL_GROWTH_SHIFT < 0 || VECL_GROWTH_SHIFT > 31
+#error "VECL_GROWTH_SHIFT must be between 0 and 31"
+#endif
+
+#if VECL_MIN_CAPACITY < 1
+#error "VECL_MIN_CAPACITY must be at least 1"
+#endif
+
+#if VECD_MIN_CAPACITY < 1 || (VECD_MIN_CAPACITY & (VECD_MIN_CAPACITY - 1))
+#error "VECD_MIN_CAPACITY must be a power of two"
+#endif
+
+#if VEC_MMAP_THRESHOLD < 1
+#error "VEC_MMAP_THRESHOLD must be at least 1"
+#endif
+
+
+static void *vec_default_alloc_(void *ud, void *ptr, size_t size) {
+  (void) ud;
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, size);
+}
+
+static vec_alloc_fn vec_alloc = vec_default_alloc_;
+static void *vec_alloc_ud;
+
+
+void vec_set_alloc(vec_alloc_fn fn, void *ud) {
+  vec_alloc = fn ? fn : vec_default_alloc_;
+  vec_alloc_ud = fn ? ud : NULL;
+}
+
+
+#ifdef VEC_MMAP
+
+static size_t vec_page_round_(size_t n) {
+  static size_t page;
+  if (page == 0) page = (size_t) sysconf(_SC_PAGESIZE);
+  return (n + page - 1) & ~(page - 1);
+}
+
+
+static void *vec_mmap_(size_t size) {
+  void *ptr = mmap(NULL, vec_page_round_(size), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+#endif
+
+
+/* Blocks of VEC_MMAP_THRESHOLD bytes or more are mapped directly and grown
+ * with mremap, which moves page tables instead of copying. Whether a block is
+ * mapped follows from its size alone, so every caller passes the block's
+ * current byte capacity as osize. Mapped blocks bypass vec_alloc entirely;
+ * this path only exists when built with VEC_USE_MMAP. */
+void *vec_resize_(void *ptr, size_t osize, size_t nsize) {
+  if (ptr == NULL) osize = 0;
+  if (ptr == NULL && nsize == 0) return NULL;
+#ifdef VEC_MMAP
+  if (osize >= VEC_MMAP_THRESHOLD || nsize >= VEC_MMAP_THRESHOLD) {
+    void *p;
+    if (osize >= VEC_MMAP_THRESHOLD && nsize >= VEC_MMAP_THRESHOLD) {
+      p = mremap(ptr, vec_page_round_(osize), vec_page_round_(nsize),
+                 MREMAP_MAYMOVE);
+      return p == MAP_FAILED ? NULL : p;
+    }
+    if (nsize == 0) {
+      munmap(ptr, vec_page_round_(osize));
+      return NULL;
+    }
+    /* crossing the threshold: move between the allocator and a mapping */
+    p = nsize >= VEC_MMAP_THRESHOLD ? vec_mmap_(nsize) :
+        vec_alloc(vec_alloc_ud, NULL, nsize);
+    if (p == NULL) return NULL;
+    if (ptr) {
+      memcpy(p, ptr, osize < nsize ? osize : nsize);
+      if (osize >= VEC_MMAP_THRESHOLD) {
+        munmap(ptr, vec_page_round_(osize));
+      } else {
+        vec_alloc(vec_alloc_ud, ptr, 0);
+      }
+    }
+    return p;
+  }
+#endif
+  (void) osize;
+  return vec_alloc(vec_alloc_ud, ptr, nsize);
+}
+
 
 int vec_expand_(char **data, int *length, int *capacity, int memsz) {
   if (*length + 1 > *capacity) {
     void *ptr;
     int n = (*capacity == 0) ? 1 : *capacity << 1;
-    ptr = realloc(*data, n * memsz);
+    ptr = vec_resize_(*data, (size_t) *capacity * memsz, (size_t) n * memsz);
     if (ptr == NULL) return -1;
     *data = ptr;
     *capacity = n;
@@ -24,7 +157,8 @@ int vec_expand_(char **data, int *length, int *capacity, int memsz) {
 int vec_reserve_(char **data, int *length, int *capacity, int memsz, int n) {
   (void) length;
   if (n > *capacity) {
-    void *ptr = realloc(*data, n * memsz);
+    void *ptr = vec_resize_(*data, (size_t) *capacity * memsz,
+                            (size_t) n * memsz);
     if (ptr == NULL) return -1;
     *data = ptr;
     *capacity = n;
@@ -45,14 +179,14 @@ int vec_reserve_po2_(
 
 int vec_compact_(char **data, int *length, int *capacity, int memsz) {
   if (*length == 0) {
-    free(*data);
+    vec_resize_(*data, (size_t) *capacity * memsz, 0);
     *data = NULL;
     *capacity = 0;
     return 0;
   } else {
     void *ptr;
     int n = *length;
-    ptr = realloc(*data, n * memsz);
+    ptr = vec_resize_(*data, (size_t) *capacity * memsz, (size_t) n * memsz);
     if (ptr == NULL) return -1;
     *capacity = n;
     *data = ptr;
@@ -112,3 +246,612 @@ void vec_swap_(char **data, int *length, int *capacity, int memsz,
   }
 }
 
+
+
+/* The find kernels scan one vector register per step and fall back to a
+ * scalar loop for the tail. The best kernel the CPU supports is picked on
+ * first use. */
+
+#define VEC_FIND_SCALAR_(data, start, length, val)\
+  do {\
+    int i__;\
+    for (i__ = (start); i__ < (length); i__++) {\
+      if ((data)[i__] == (val)) return i__;\
+    }\
+    return -1;\
+  } while (0)
+
+#ifdef VEC_SIMD_X86
+
+enum { VEC_SIMD_NONE, VEC_SIMD_SSE2, VEC_SIMD_AVX2 };
+
+static int vec_simd_level_(void) {
+  static int level = -1;
+  if (level < 0) {
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? VEC_SIMD_AVX2 :
+            __builtin_cpu_supports("sse2") ? VEC_SIMD_SSE2 :
+            VEC_SIMD_NONE;
+  }
+  return level;
+}
+
+
+#define VEC_TZCNT_(mask) __builtin_ctz((unsigned) (mask))
+
+
+__attribute__((target("sse2")))
+static int vec_find_int_sse2_(const int *data, int length, int val) {
+  __m128i k = _mm_set1_epi32(val);
+  int i, m;
+  for (i = 0; i + 4 <= length; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (data + i));
+    m = _mm_movemask_epi8(_mm_cmpeq_epi32(x, k));
+    if (m) return i + VEC_TZCNT_(m) / 4;
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("avx2")))
+static int vec_find_int_avx2_(const int *data, int length, int val) {
+  __m256i k = _mm256_set1_epi32(val);
+  int i, m;
+  for (i = 0; i + 8 <= length; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (data + i));
+    m = _mm256_movemask_epi8(_mm256_cmpeq_epi32(x, k));
+    if (m) return i + VEC_TZCNT_(m) / 4;
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("sse2")))
+static int vec_find_char_sse2_(const char *data, int length, char val) {
+  __m128i k = _mm_set1_epi8(val);
+  int i, m;
+  for (i = 0; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (data + i));
+    m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, k));
+    if (m) return i + VEC_TZCNT_(m);
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("avx2")))
+static int vec_find_char_avx2_(const char *data, int length, char val) {
+  __m256i k = _mm256_set1_epi8(val);
+  int i, m;
+  for (i = 0; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (data + i));
+    m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, k));
+    if (m) return i + VEC_TZCNT_(m);
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("sse2")))
+static int vec_find_float_sse2_(const float *data, int length, float val) {
+  __m128 k = _mm_set1_ps(val);
+  int i, m;
+  for (i = 0; i + 4 <= length; i += 4) {
+    m = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(data + i), k));
+    if (m) return i + VEC_TZCNT_(m);
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("avx2")))
+static int vec_find_float_avx2_(const float *data, int length, float val) {
+  __m256 k = _mm256_set1_ps(val);
+  int i, m;
+  for (i = 0; i + 8 <= length; i += 8) {
+    __m256 x = _mm256_loadu_ps(data + i);
+    m = _mm256_movemask_ps(_mm256_cmp_ps(x, k, _CMP_EQ_OQ));
+    if (m) return i + VEC_TZCNT_(m);
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("sse2")))
+static int vec_find_double_sse2_(const double *data, int length, double val) {
+  __m128d k = _mm_set1_pd(val);
+  int i, m;
+  for (i = 0; i + 2 <= length; i += 2) {
+    m = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(data + i), k));
+    if (m) return i + VEC_TZCNT_(m);
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+
+__attribute__((target("avx2")))
+static int vec_find_double_avx2_(const double *data, int length, double val) {
+  __m256d k = _mm256_set1_pd(val);
+  int i, m;
+  for (i = 0; i + 4 <= length; i += 4) {
+    __m256d x = _mm256_loadu_pd(data + i);
+    m = _mm256_movemask_pd(_mm256_cmp_pd(x, k, _CMP_EQ_OQ));
+    if (m) return i + VEC_TZCNT_(m);
+  }
+  VEC_FIND_SCALAR_(data, i, length, val);
+}
+
+#define VEC_FIND_DISPATCH_(name, data, length, val)\
+  switch (vec_simd_level_()) {\
+    case VEC_SIMD_AVX2: return vec_find_##name##_avx2_(data, length, val);\
+    case VEC_SIMD_SSE2: return vec_find_##name##_sse2_(data, length, val);\
+  }
+
+#else
+
+#define VEC_FIND_DISPATCH_(name, data, length, val)
+
+#endif
+
+
+int vec_find_int_(const int *data, int length, int val) {
+  VEC_FIND_DISPATCH_(int, data, length, val);
+  VEC_FIND_SCALAR_(data, 0, length, val);
+}
+
+
+int vec_find_char_(const char *data, int length, char val) {
+  VEC_FIND_DISPATCH_(char, data, length, val);
+  VEC_FIND_SCALAR_(data, 0, length, val);
+}
+
+
+int vec_find_float_(const float *data, int length, float val) {
+  VEC_FIND_DISPATCH_(float, data, length, val);
+  VEC_FIND_SCALAR_(data, 0, length, val);
+}
+
+
+int vec_find_double_(const double *data, int length, double val) {
+  VEC_FIND_DISPATCH_(double, data, length, val);
+  VEC_FIND_SCALAR_(data, 0, length, val);
+}
+
+
+/* The scalar sorts use an LSD radix sort on an order-preserving unsigned key
+ * once the vec is large enough to amortize the histogram passes, and an
+ * inlined introsort below that or when the scratch buffer can't be had. */
+
+#define VEC_RADIX_MIN 256
+
+static uint32_t vec_key_int_(int x) {
+  return (uint32_t) x ^ 0x80000000u;
+}
+
+
+static uint32_t vec_key_float_(float x) {
+  uint32_t u;
+  memcpy(&u, &x, sizeof(u));
+  return (u & 0x80000000u) ? ~u : u | 0x80000000u;
+}
+
+
+static uint64_t vec_key_double_(double x) {
+  uint64_t u;
+  memcpy(&u, &x, sizeof(u));
+  return (u & 0x8000000000000000ull) ? ~u : u | 0x8000000000000000ull;
+}
+
+
+/* floats compare by radix key on both paths, so the order of NaNs and
+ * signed zeros doesn't depend on the vec's length */
+#define vec_less_(a, b) ((a) < (b))
+#define vec_less_float_(a, b) (vec_key_float_(a) < vec_key_float_(b))
+#define vec_less_double_(a, b) (vec_key_double_(a) < vec_key_double_(b))
+VEC_SORT_DEFINE(vec_introsort_int_, int, vec_less_)
+VEC_SORT_DEFINE(vec_introsort_float_, float, vec_less_float_)
+VEC_SORT_DEFINE(vec_introsort_double_, double, vec_less_double_)
+
+
+#define VEC_RADIX_DEFINE_(name, T, K, key)\
+  static int name(T *data, int n) {\
+    T *src = data, *dst, *tmp;\
+    size_t count[256];\
+    unsigned shift;\
+    int i;\
+    tmp = vec_resize_(NULL, 0, n * sizeof(*tmp));\
+    if (tmp == NULL) return -1;\
+    dst = tmp;\
+    for (shift = 0; shift < sizeof(K) * 8; shift += 8) {\
+      size_t sum = 0, c;\
+      memset(count, 0, sizeof(count));\
+      for (i = 0; i < n; i++) count[(key(src[i]) >> shift) & 0xff]++;\
+      /* every element shares this digit: the pass wouldn't move anything */\
+      if (count[(key(src[0]) >> shift) & 0xff] == (size_t) n) continue;\
+      for (i = 0; i < 256; i++) {\
+        c = count[i];\
+        count[i] = sum;\
+        sum += c;\
+      }\
+      for (i = 0; i < n; i++) dst[count[(key(src[i]) >> shift) & 0xff]++] = src[i];\
+      dst = src;\
+      src = (src == data) ? tmp : data;\
+    }\
+    if (src != data) memcpy(data, src, n * sizeof(*data));\
+    vec_resize_(tmp, n * sizeof(*tmp), 0);\
+    return 0;\
+  }
+
+VEC_RADIX_DEFINE_(vec_radixsort_int_, int, uint32_t, vec_key_int_)
+VEC_RADIX_DEFINE_(vec_radixsort_float_, float, uint32_t, vec_key_float_)
+VEC_RADIX_DEFINE_(vec_radixsort_double_, double, uint64_t, vec_key_double_)
+
+
+void vec_sort_int_(int *data, int length) {
+  if (length >= VEC_RADIX_MIN && vec_radixsort_int_(data, length) == 0) return;
+  vec_introsort_int_(data, length);
+}
+
+
+void vec_sort_char_(char *data, int length) {
+  /* a counting sort is always cheapest with only 256 keys */
+  size_t count[256];
+  int i, k;
+  if (length <= 0) return;
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < length; i++) count[(unsigned char) data[i]]++;
+  /* walk the keys in signed order if char is signed */
+  for (i = 0, k = (char) -1 < 0 ? 128 : 0; i < 256; i++, k = (k + 1) & 0xff) {
+    memset(data, (char) k, count[k]);
+    data += count[k];
+  }
+}
+
+
+void vec_sort_float_(float *data, int length) {
+  if (length >= VEC_RADIX_MIN && vec_radixsort_float_(data, length) == 0) {
+    return;
+  }
+  vec_introsort_float_(data, length);
+}
+
+
+void vec_sort_double_(double *data, int length) {
+  if (length >= VEC_RADIX_MIN && vec_radixsort_double_(data, length) == 0) {
+    return;
+  }
+  vec_introsort_double_(data, length);
+}
+
+
+int vec_insertarr_(char **data, int *length, int *capacity, int memsz,
+                   int idx, const void *arr, int count
+) {
+  int err;
+  if (count < 0 || idx < 0 || idx > *length) return -1;
+  if (count > INT_MAX - *length) return -1;
+  if (count == 0) return 0;
+  err = vec_reserve_po2_(data, length, capacity, memsz, *length + count);
+  if (err) return err;
+  memmove(*data + (idx + count) * memsz,
+          *data + idx * memsz,
+          (*length - idx) * memsz);
+  memcpy(*data + idx * memsz, arr, count * memsz);
+  return 0;
+}
+
+
+int vec_splicearr_(char **data, int *length, int *capacity, int memsz,
+                   int start, int count, const void *arr, int n
+) {
+  if (start < 0 || count < 0 || n < 0) return -1;
+  if (start > *length || count > *length - start) return -1;
+  if (n - count > INT_MAX - *length) return -1;
+  if (n > count) {
+    int err = vec_reserve_po2_(data, length, capacity, memsz,
+                               *length + n - count);
+    if (err) return err;
+  }
+  if (n != count) {
+    memmove(*data + (start + n) * memsz,
+            *data + (start + count) * memsz,
+            (*length - start - count) * memsz);
+  }
+  if (n > 0) memcpy(*data + start * memsz, arr, n * memsz);
+  return 0;
+}
+
+
+/* a vecl_t's own allocator, if it has one, takes the place of vec_resize_
+ * and with it of the mmap path */
+static void *vecl_resize_(vec_alloc_fn fn, void *ud, void *ptr, size_t osize,
+                          size_t nsize) {
+  if (fn == NULL) return vec_resize_(ptr, osize, nsize);
+  if (ptr == NULL && nsize == 0) return NULL;
+  return fn(ud, ptr, nsize);
+}
+
+
+int vecl_grow_(char **data, size_t *length, size_t *capacity, size_t memsz,
+               vec_alloc_fn fn, void *ud, size_t n
+) {
+  size_t n2 = *capacity;
+  if (n <= n2) return 0;
+  if (n2 < VECL_MIN_CAPACITY) n2 = VECL_MIN_CAPACITY;
+  while (n2 < n) {
+    size_t step = n2 >> VECL_GROWTH_SHIFT;
+    /* small capacities under a large shift would never grow otherwise */
+    if (step == 0) step = 1;
+    if (n2 > (size_t) -1 - step) {
+      n2 = n;
+      break;
+    }
+    n2 += step;
+  }
+  return vecl_reserve_(data, length, capacity, memsz, fn, ud, n2);
+}
+
+
+int vecl_expand_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 vec_alloc_fn fn, void *ud
+) {
+  if (*length + 1 > *capacity) {
+    return vecl_grow_(data, length, capacity, memsz, fn, ud, *length + 1);
+  }
+  return 0;
+}
+
+
+int vecl_reserve_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                  vec_alloc_fn fn, void *ud, size_t n
+) {
+  (void) length;
+  if (n > *capacity) {
+    void *ptr;
+    if (n > (size_t) -1 / memsz) return -1;
+    ptr = vecl_resize_(fn, ud, *data, *capacity * memsz, n * memsz);
+    if (ptr == NULL) return -1;
+    *data = ptr;
+    *capacity = n;
+  }
+  return 0;
+}
+
+
+int vecl_compact_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                  vec_alloc_fn fn, void *ud
+) {
+  if (*length == 0) {
+    vecl_free_(data, length, capacity, memsz, fn, ud);
+    return 0;
+  } else {
+    void *ptr;
+    size_t n = *length;
+    ptr = vecl_resize_(fn, ud, *data, *capacity * memsz, n * memsz);
+    if (ptr == NULL) return -1;
+    *capacity = n;
+    *data = ptr;
+  }
+  return 0;
+}
+
+
+void vecl_free_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                vec_alloc_fn fn, void *ud
+) {
+  (void) length;
+  vecl_resize_(fn, ud, *data, *capacity * memsz, 0);
+  *data = NULL;
+  *capacity = 0;
+}
+
+
+int vecl_insert_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 vec_alloc_fn fn, void *ud, size_t idx
+) {
+  int err = vecl_expand_(data, length, capacity, memsz, fn, ud);
+  if (err) return err;
+  memmove(*data + (idx + 1) * memsz,
+          *data + idx * memsz,
+          (*length - idx) * memsz);
+  return 0;
+}
+
+
+void vecl_splice_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                  size_t start, size_t count
+) {
+  (void) capacity;
+  memmove(*data + start * memsz,
+          *data + (start + count) * memsz,
+          (*length - start - count) * memsz);
+}
+
+
+void vecl_swapsplice_(char **data, size_t *length, size_t *capacity,
+                      size_t memsz, size_t start, size_t count
+) {
+  (void) capacity;
+  memmove(*data + start * memsz,
+          *data + (*length - count) * memsz,
+          count * memsz);
+}
+
+
+void vecl_swap_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                size_t idx1, size_t idx2
+) {
+  unsigned char *a, *b, tmp;
+  size_t count;
+  (void) length;
+  (void) capacity;
+  if (idx1 == idx2) return;
+  a = (unsigned char*) *data + idx1 * memsz;
+  b = (unsigned char*) *data + idx2 * memsz;
+  count = memsz;
+  while (count--) {
+    tmp = *a;
+    *a = *b;
+    *b = tmp;
+    a++, b++;
+  }
+}
+
+
+int vecs_reserve_(char **data, int *length, int *capacity, int memsz,
+                  char *inl, int inlcap, int n
+) {
+  void *ptr;
+  if (n <= *capacity) return 0;
+  if (*data == inl) {
+    /* first spill: copy the inline elements out to the heap */
+    ptr = vec_resize_(NULL, 0, (size_t) n * memsz);
+    if (ptr == NULL) return -1;
+    memcpy(ptr, inl, *length * memsz);
+  } else {
+    ptr = vec_resize_(*data, (size_t) *capacity * memsz, (size_t) n * memsz);
+    if (ptr == NULL) return -1;
+  }
+  (void) inlcap;
+  *data = ptr;
+  *capacity = n;
+  return 0;
+}
+
+
+int vecs_expand_(char **data, int *length, int *capacity, int memsz,
+                 char *inl, int inlcap
+) {
+  if (*length + 1 > *capacity) {
+    return vecs_reserve_(data, length, capacity, memsz, inl, inlcap,
+                         *capacity << 1);
+  }
+  return 0;
+}
+
+
+int vecs_reserve_po2_(
+  char **data, int *length, int *capacity, int memsz, char *inl, int inlcap,
+  int n
+) {
+  int n2 = 1;
+  if (n <= *capacity) return 0;
+  while (n2 < n) n2 <<= 1;
+  return vecs_reserve_(data, length, capacity, memsz, inl, inlcap, n2);
+}
+
+
+int vecs_compact_(char **data, int *length, int *capacity, int memsz,
+                  char *inl, int inlcap
+) {
+  if (*data == inl) return 0;
+  if (*length <= inlcap) {
+    /* fits inline again: move back and release the heap buffer */
+    memcpy(inl, *data, *length * memsz);
+    vec_resize_(*data, (size_t) *capacity * memsz, 0);
+    *data = inl;
+    *capacity = inlcap;
+    return 0;
+  }
+  return vec_compact_(data, length, capacity, memsz);
+}
+
+
+int vecs_insert_(char **data, int *length, int *capacity, int memsz,
+                 char *inl, int inlcap, int idx
+) {
+  int err = vecs_expand_(data, length, capacity, memsz, inl, inlcap);
+  if (err) return err;
+  memmove(*data + (idx + 1) * memsz,
+          *data + idx * memsz,
+          (*length - idx) * memsz);
+  return 0;
+}
+
+
+int vecd_reserve_(char **data, int *head, int *length, int *capacity,
+                  int memsz, int n
+) {
+  void *ptr;
+  int n2 = VECD_MIN_CAPACITY, wrapped;
+  if (n <= *capacity) return 0;
+  while (n2 < n) n2 <<= 1;
+  ptr = vec_resize_(*data, (size_t) *capacity * memsz, (size_t) n2 * memsz);
+  if (ptr == NULL) return -1;
+  /* elements that wrapped past the old end move to just after it, where at
+   * least as many new slots have appeared */
+  wrapped = *head + *length - *capacity;
+  if (wrapped > 0) {
+    memcpy((char*) ptr + *capacity * memsz, ptr, wrapped * memsz);
+  }
+  *data = ptr;
+  *capacity = n2;
+  return 0;
+}
+
+
+int vecd_expand_(char **data, int *head, int *length, int *capacity,
+                 int memsz
+) {
+  if (*length + 1 > *capacity) {
+    return vecd_reserve_(data, head, length, capacity, memsz, *length + 1);
+  }
+  return 0;
+}
+
+
+#ifdef __GNUC__
+
+/* a segment's published flags follow its elements in the same block */
+static unsigned char *vecc_flags_(char *seg, int k, size_t memsz) {
+  return (unsigned char*) seg + (VECC_BASE << k) * memsz;
+}
+
+
+size_t vecc_claim_(char **seg, size_t *length, size_t memsz) {
+  size_t idx = __atomic_fetch_add(length, 1, __ATOMIC_ACQ_REL);
+  int k = vecc_seg_(idx);
+  char *s = __atomic_load_n(&seg[k], __ATOMIC_ACQUIRE), *expected = NULL;
+  if (s == NULL) {
+    /* Several threads may race to allocate the segment; one wins the CAS
+     * and the others free theirs. calloc rather than the vec allocator, as
+     * the latter need not be thread-safe. */
+    s = calloc((VECC_BASE << k) * (memsz + 1), 1);
+    if (s == NULL) return (size_t) -1;
+    if (!__atomic_compare_exchange_n(&seg[k], &expected, s, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(s);
+    }
+  }
+  return idx;
+}
+
+
+void vecc_publish_(char **seg, size_t *length, size_t memsz, size_t idx) {
+  int k = vecc_seg_(idx);
+  char *s = __atomic_load_n(&seg[k], __ATOMIC_ACQUIRE);
+  (void) length;
+  __atomic_store_n(&vecc_flags_(s, k, memsz)[vecc_off_(idx)], 1,
+                   __ATOMIC_RELEASE);
+}
+
+
+int vecc_ready_(char **seg, size_t *length, size_t memsz, size_t idx) {
+  int k = vecc_seg_(idx);
+  char *s;
+  if (idx >= __atomic_load_n(length, __ATOMIC_ACQUIRE)) return 0;
+  s = __atomic_load_n(&seg[k], __ATOMIC_ACQUIRE);
+  if (s == NULL) return 0;
+  return __atomic_load_n(&vecc_flags_(s, k, memsz)[vecc_off_(idx)],
+                         __ATOMIC_ACQUIRE);
+}
+
+
+void vecc_deinit_(char **seg, size_t *length, size_t memsz) {
+  int k;
+  (void) length;
+  (void) memsz;
+  for (k = 0; k < VECC_SEGMENTS; k++) free(seg[k]);
+}
+
+#endif
@@ -14,6 +14,21 @@
 #define VEC_VERSION "0.2.1"
 
 
+/* All vec memory goes through a realloc-like allocator (size 0 frees), which
+ * is realloc/free unless replaced with vec_set_alloc(). The allocator is
+ * global: a vec must be freed under the allocator it was allocated with.
+ * On Linux, vec.c built with VEC_USE_MMAP maps blocks of VEC_MMAP_THRESHOLD
+ * bytes or more directly and grows them with mremap; both are flags for
+ * building vec.c (see there). Mapped blocks never reach the allocator, so a
+ * tracking allocator (dmt, ...) does not see them; leave VEC_USE_MMAP
+ * undefined when every vec byte must be accounted for. */
+
+typedef void *(*vec_alloc_fn)(void *ud, void *ptr, size_t size);
+
+void vec_set_alloc(vec_alloc_fn fn, void *ud); /* NULL fn restores the default */
+void *vec_resize_(void *ptr, size_t osize, size_t nsize);
+
+
 #define vec_unpack_(v)\
   (char**)&(v)->data, &(v)->length, &(v)->capacity, sizeof(*(v)->data)
 
@@ -27,7 +42,7 @@
 
 
 #define vec_deinit(v)\
-  ( free((v)->data),\
+  ( vec_resize_((v)->data, (v)->capacity * sizeof(*(v)->data), 0),\
     vec_init(v) ) 
 
 
@@ -59,6 +74,97 @@
   qsort((v)->data, (v)->length, sizeof(*(v)->data), fn)
 
 
+/* type-specialized sorts for the scalar vec types: radix sort for large
+ * vecs, introsort otherwise. Floats are ordered by bit pattern at any
+ * length: -0 before 0, negative NaNs first and positive NaNs last */
+#define vec_sort_int(v)    vec_sort_int_((v)->data, (v)->length)
+#define vec_sort_char(v)   vec_sort_char_((v)->data, (v)->length)
+#define vec_sort_float(v)  vec_sort_float_((v)->data, (v)->length)
+#define vec_sort_double(v) vec_sort_double_((v)->data, (v)->length)
+
+
+/* sorts with a function generated by VEC_SORT_DEFINE */
+#define vec_sort_with(v, fn)\
+  fn((v)->data, (v)->length)
+
+
+/* VEC_SORT_DEFINE(name, T, less) defines `static void name(T *data, int n)`,
+ * an introsort whose comparison `less(a, b)` is expanded inline, e.g.
+ *
+ *   #define point_less(a, b) ((a).x < (b).x)
+ *   VEC_SORT_DEFINE(sort_points, Point, point_less)
+ *   vec_sort_with(&points, sort_points);
+ */
+#define VEC_SORT_DEFINE(name, T, less)\
+  static void name##_isort_(T *a, int n) {\
+    int i, j;\
+    for (i = 1; i < n; i++) {\
+      T x = a[i];\
+      for (j = i; j > 0 && less(x, a[j - 1]); j--) a[j] = a[j - 1];\
+      a[j] = x;\
+    }\
+  }\
+  static void name##_sift_(T *a, int root, int n) {\
+    T x = a[root];\
+    int child;\
+    while ((child = 2 * root + 1) < n) {\
+      if (child + 1 < n && less(a[child], a[child + 1])) child++;\
+      if (!less(x, a[child])) break;\
+      a[root] = a[child];\
+      root = child;\
+    }\
+    a[root] = x;\
+  }\
+  static void name##_hsort_(T *a, int n) {\
+    int i;\
+    T x;\
+    for (i = n / 2 - 1; i >= 0; i--) name##_sift_(a, i, n);\
+    for (i = n - 1; i > 0; i--) {\
+      x = a[0]; a[0] = a[i]; a[i] = x;\
+      name##_sift_(a, 0, i);\
+    }\
+  }\
+  static void name##_qsort_(T *a, int n, int depth) {\
+    while (n > 16) {\
+      int i = -1, j = n, mid = (n - 1) / 2;\
+      T x, p;\
+      if (depth-- == 0) {\
+        name##_hsort_(a, n);\
+        return;\
+      }\
+      /* median of three ends up at mid */\
+      if (less(a[mid], a[0])) { x = a[mid]; a[mid] = a[0]; a[0] = x; }\
+      if (less(a[n - 1], a[mid])) {\
+        x = a[mid]; a[mid] = a[n - 1]; a[n - 1] = x;\
+        if (less(a[mid], a[0])) { x = a[mid]; a[mid] = a[0]; a[0] = x; }\
+      }\
+      p = a[mid];\
+      for (;;) {\
+        do i++; while (less(a[i], p));\
+        do j--; while (less(p, a[j]));\
+        if (i >= j) break;\
+        x = a[i]; a[i] = a[j]; a[j] = x;\
+      }\
+      /* recurse into the smaller half, loop on the larger */\
+      j++;\
+      if (j < n - j) {\
+        name##_qsort_(a, j, depth);\
+        a += j;\
+        n -= j;\
+      } else {\
+        name##_qsort_(a + j, n - j, depth);\
+        n = j;\
+      }\
+    }\
+  }\
+  static void name(T *data, int n) {\
+    int depth = 0, m;\
+    for (m = n; m > 1; m >>= 1) depth += 2;\
+    name##_qsort_(data, n, depth);\
+    name##_isort_(data, n);\
+  }
+
+
 #define vec_swap(v, idx1, idx2)\
   vec_swap_(vec_unpack_(v), idx1, idx2)
 
@@ -87,20 +193,57 @@
   vec_compact_(vec_unpack_(v))
 
 
-#define vec_pusharr(v, arr, count)\
+/* arrays of the vec's own element type are copied in bulk, anything else
+ * (including other types of the same size) is converted element by element;
+ * the space must already be reserved. Without a way to compare types at
+ * compile time every array is converted */
+#if defined(__GNUC__) || defined(__clang__)
+#define vec_same_type_(a, b)\
+  __builtin_types_compatible_p(__typeof__(a), __typeof__(b))
+#else
+#define vec_same_type_(a, b) 0
+#endif
+
+#define vec_copyarr_(v, arr, n)\
   do {\
-    int i__, n__ = (count);\
-    if (vec_reserve_po2_(vec_unpack_(v), (v)->length + n__) != 0) break;\
-    for (i__ = 0; i__ < n__; i__++) {\
-      (v)->data[(v)->length++] = (arr)[i__];\
+    if (vec_same_type_(*(arr), *(v)->data)) {\
+      memcpy((v)->data + (v)->length, (arr), (n) * sizeof(*(v)->data));\
+      (v)->length += (n);\
+    } else {\
+      size_t j__;\
+      for (j__ = 0; j__ < (size_t) (n); j__++) {\
+        (v)->data[(v)->length++] = (arr)[j__];\
+      }\
     }\
   } while (0)
 
 
+#define vec_pusharr(v, arr, count)\
+  do {\
+    int n__ = (count);\
+    if (n__ <= 0 || vec_reserve_po2_(vec_unpack_(v), (v)->length + n__) != 0) break;\
+    vec_copyarr_(v, arr, n__);\
+  } while (0)
+
+
 #define vec_extend(v, v2)\
   vec_pusharr((v), (v2)->data, (v2)->length)
 
 
+/* insertarr and splicearr copy raw elements of the vec's own type; arr must
+ * not point into v. splicearr replaces count elements at start with n. Both
+ * return -1 and leave v unchanged on a negative count or an index out of
+ * range */
+#define vec_insertarr(v, idx, arr, count)\
+  ( vec_insertarr_(vec_unpack_(v), idx, arr, count) ? -1 :\
+    ((v)->length += (count), 0) )
+
+
+#define vec_splicearr(v, start, count, arr, n)\
+  ( vec_splicearr_(vec_unpack_(v), start, count, arr, n) ? -1 :\
+    ((v)->length += (n) - (count), 0) )
+
+
 #define vec_find(v, val, idx)\
   do {\
     for ((idx) = 0; (idx) < (v)->length; (idx)++) {\
@@ -118,6 +261,32 @@
   } while (0)
 
 
+/* find and remove for the scalar vec types, using SSE2/AVX2 when the CPU
+ * supports it; floats compare with == as vec_find does, so NaN never
+ * matches */
+#define vec_find_int(v, val, idx)\
+  ((idx) = vec_find_int_((v)->data, (v)->length, (val)))
+#define vec_find_char(v, val, idx)\
+  ((idx) = vec_find_char_((v)->data, (v)->length, (val)))
+#define vec_find_float(v, val, idx)\
+  ((idx) = vec_find_float_((v)->data, (v)->length, (val)))
+#define vec_find_double(v, val, idx)\
+  ((idx) = vec_find_double_((v)->data, (v)->length, (val)))
+
+
+#define vec_remove_int(v, val)    vec_remove_typed_(v, val, int)
+#define vec_remove_char(v, val)   vec_remove_typed_(v, val, char)
+#define vec_remove_float(v, val)  vec_remove_typed_(v, val, float)
+#define vec_remove_double(v, val) vec_remove_typed_(v, val, double)
+
+#define vec_remove_typed_(v, val, T)\
+  do {\
+    int idx__;\
+    vec_find_##T(v, val, idx__);\
+    if (idx__ != -1) vec_splice(v, idx__, 1);\
+  } while (0)
+
+
 #define vec_reverse(v)\
   do {\
     int i__ = (v)->length / 2;\
@@ -169,6 +338,18 @@ void vec_swapsplice_(char **data, int *length, int *capacity, int memsz,
                      int start, int count);
 void vec_swap_(char **data, int *length, int *capacity, int memsz,
                int idx1, int idx2);
+void vec_sort_int_(int *data, int length);
+void vec_sort_char_(char *data, int length);
+void vec_sort_float_(float *data, int length);
+void vec_sort_double_(double *data, int length);
+int vec_find_int_(const int *data, int length, int val);
+int vec_find_char_(const char *data, int length, char val);
+int vec_find_float_(const float *data, int length, float val);
+int vec_find_double_(const double *data, int length, double val);
+int vec_insertarr_(char **data, int *length, int *capacity, int memsz,
+                   int idx, const void *arr, int count);
+int vec_splicearr_(char **data, int *length, int *capacity, int memsz,
+                   int start, int count, const void *arr, int n);
 
 
 typedef vec_t(void*) vec_void_t;
@@ -178,4 +359,385 @@ typedef vec_t(char) vec_char_t;
 typedef vec_t(float) vec_float_t;
 typedef vec_t(double) vec_double_t;
 
+
+/* vecs_t: a vec with room for N elements stored inline, which only moves to
+ * the heap once it outgrows them. Every vec_* macro that doesn't allocate
+ * (pop, splice, swapsplice, sort, swap, truncate, clear, first, last, find,
+ * remove, reverse and the foreach family) works on a vecs_t as is; the
+ * macros below replace the ones that do. As data may point into the struct
+ * itself, a vecs_t must not be copied or moved with memcpy or assignment. */
+
+#define vecs_unpack_(v)\
+  vec_unpack_(v), (char*)(v)->inline_, (int)(sizeof((v)->inline_) / sizeof(*(v)->data))
+
+
+#define vecs_t(T, N)\
+  struct { T *data; int length, capacity; T inline_[N]; }
+
+
+#define vecs_init(v)\
+  ( (v)->data = (v)->inline_, (v)->length = 0,\
+    (v)->capacity = (int)(sizeof((v)->inline_) / sizeof(*(v)->data)) )
+
+
+#define vecs_is_inline(v)\
+  ((v)->data == (v)->inline_)
+
+
+#define vecs_deinit(v)\
+  ( vecs_is_inline(v) ? NULL :\
+    vec_resize_((v)->data, (v)->capacity * sizeof(*(v)->data), 0),\
+    vecs_init(v) )
+
+
+#define vecs_push(v, val)\
+  ( vecs_expand_(vecs_unpack_(v)) ? -1 :\
+    ((v)->data[(v)->length++] = (val), 0) )
+
+
+#define vecs_insert(v, idx, val)\
+  ( vecs_insert_(vecs_unpack_(v), idx) ? -1 :\
+    ((v)->data[idx] = (val), (v)->length++, 0) )
+
+
+#define vecs_reserve(v, n)\
+  vecs_reserve_(vecs_unpack_(v), n)
+
+
+#define vecs_compact(v)\
+  vecs_compact_(vecs_unpack_(v))
+
+
+#define vecs_pusharr(v, arr, count)\
+  do {\
+    int n__ = (count);\
+    if (n__ <= 0 || vecs_reserve_po2_(vecs_unpack_(v), (v)->length + n__) != 0) break;\
+    vec_copyarr_(v, arr, n__);\
+  } while (0)
+
+
+#define vecs_extend(v, v2)\
+  vecs_pusharr((v), (v2)->data, (v2)->length)
+
+
+
+int vecs_expand_(char **data, int *length, int *capacity, int memsz,
+                 char *inl, int inlcap);
+int vecs_reserve_(char **data, int *length, int *capacity, int memsz,
+                  char *inl, int inlcap, int n);
+int vecs_reserve_po2_(char **data, int *length, int *capacity, int memsz,
+                      char *inl, int inlcap, int n);
+int vecs_compact_(char **data, int *length, int *capacity, int memsz,
+                  char *inl, int inlcap);
+int vecs_insert_(char **data, int *length, int *capacity, int memsz,
+                 char *inl, int inlcap, int idx);
+
+/* vecd_t: a double-ended queue on a power-of-two ring buffer. Elements are
+ * pushed and popped at either end in O(1) without moving the others; the
+ * i-th element from the front is vecd_at(v, i). Popping from an empty vecd_t
+ * is undefined, as with vec_pop. The first allocation holds VECD_MIN_CAPACITY
+ * elements, a flag for building vec.c (see there). */
+
+
+#define vecd_unpack_(v)\
+  (char**)&(v)->data, &(v)->head, &(v)->length, &(v)->capacity,\
+  sizeof(*(v)->data)
+
+
+#define vecd_t(T)\
+  struct { T *data; int head, length, capacity; }
+
+
+#define vecd_mask_(v, i)\
+  ((i) & ((v)->capacity - 1))
+
+
+#define vecd_init(v)\
+  memset((v), 0, sizeof(*(v)))
+
+
+#define vecd_deinit(v)\
+  ( vec_resize_((v)->data, (v)->capacity * sizeof(*(v)->data), 0),\
+    vecd_init(v) )
+
+
+#define vecd_push_back(v, val)\
+  ( vecd_expand_(vecd_unpack_(v)) ? -1 :\
+    ((v)->data[vecd_mask_(v, (v)->head + (v)->length)] = (val),\
+     (v)->length++, 0) )
+
+
+#define vecd_push_front(v, val)\
+  ( vecd_expand_(vecd_unpack_(v)) ? -1 :\
+    ((v)->head = vecd_mask_(v, (v)->head - 1),\
+     (v)->data[(v)->head] = (val), (v)->length++, 0) )
+
+
+#define vecd_pop_back(v)\
+  (v)->data[vecd_mask_(v, (v)->head + --(v)->length)]
+
+
+#define vecd_pop_front(v)\
+  ( (v)->length--, (v)->head = vecd_mask_(v, (v)->head + 1),\
+    (v)->data[vecd_mask_(v, (v)->head - 1)] )
+
+
+#define vecd_at(v, idx)\
+  (v)->data[vecd_mask_(v, (v)->head + (idx))]
+
+
+#define vecd_front(v)\
+  vecd_at(v, 0)
+
+
+#define vecd_back(v)\
+  vecd_at(v, (v)->length - 1)
+
+
+#define vecd_clear(v)\
+  ((v)->head = (v)->length = 0)
+
+
+#define vecd_reserve(v, n)\
+  vecd_reserve_(vecd_unpack_(v), n)
+
+
+#define vecd_foreach(v, var, iter)\
+  if  ( (v)->length > 0 )\
+  for ( (iter) = 0;\
+        (iter) < (v)->length && (((var) = vecd_at(v, iter)), 1);\
+        ++(iter))
+
+
+
+int vecd_expand_(char **data, int *head, int *length, int *capacity,
+                 int memsz);
+int vecd_reserve_(char **data, int *head, int *length, int *capacity,
+                  int memsz, int n);
+
+/* vecl_t: a vec with size_t length and capacity. Growth is geometric by
+ * 1 + 1/2^VECL_GROWTH_SHIFT (0 doubles, 1 grows by 1.5x) and the first
+ * allocation holds at least VECL_MIN_CAPACITY elements; both are flags for
+ * building vec.c (see there). A vecl_t can carry its own allocator, set with
+ * vecl_set_alloc while it is empty, which it then uses instead of the global
+ * one for all of its memory. vec_init (leaving the global allocator), vec_pop,
+ * vec_truncate, vec_clear, vec_first, vec_last, vec_sort, vec_foreach and
+ * vec_foreach_ptr work on a vecl_t as well; the macros below cover everything
+ * that depends on the length type or allocates. */
+
+#define VECL_NPOS ((size_t) -1)
+
+
+#define vecl_unpack_(v)\
+  (char**)&(v)->data, &(v)->length, &(v)->capacity, sizeof(*(v)->data)
+
+
+#define vecl_unpack_alloc_(v)\
+  vecl_unpack_(v), (v)->alloc, (v)->alloc_ud
+
+
+#define vecl_t(T)\
+  struct {\
+    T *data; size_t length, capacity;\
+    vec_alloc_fn alloc; void *alloc_ud;\
+  }
+
+
+/* a NULL fn goes back to the global allocator */
+#define vecl_set_alloc(v, fn, ud)\
+  ( (v)->alloc = (fn), (v)->alloc_ud = (ud) )
+
+
+#define vecl_deinit(v)\
+  ( vecl_free_(vecl_unpack_alloc_(v)),\
+    (v)->data = NULL, (v)->length = (v)->capacity = 0 )
+
+
+#define vecl_push(v, val)\
+  ( vecl_expand_(vecl_unpack_alloc_(v)) ? -1 :\
+    ((v)->data[(v)->length++] = (val), 0) )
+
+
+#define vecl_splice(v, start, count)\
+  ( vecl_splice_(vecl_unpack_(v), start, count),\
+    (v)->length -= (count) )
+
+
+#define vecl_swapsplice(v, start, count)\
+  ( vecl_swapsplice_(vecl_unpack_(v), start, count),\
+    (v)->length -= (count) )
+
+
+#define vecl_insert(v, idx, val)\
+  ( vecl_insert_(vecl_unpack_alloc_(v), idx) ? -1 :\
+    ((v)->data[idx] = (val), (v)->length++, 0) )
+
+
+#define vecl_swap(v, idx1, idx2)\
+  vecl_swap_(vecl_unpack_(v), idx1, idx2)
+
+
+#define vecl_reserve(v, n)\
+  vecl_reserve_(vecl_unpack_alloc_(v), n)
+
+
+#define vecl_compact(v)\
+  vecl_compact_(vecl_unpack_alloc_(v))
+
+
+#define vecl_pusharr(v, arr, count)\
+  do {\
+    size_t n__ = (count);\
+    if (n__ == 0 || n__ > (size_t) -1 - (v)->length) break;\
+    if (vecl_grow_(vecl_unpack_alloc_(v), (v)->length + n__) != 0) break;\
+    vec_copyarr_(v, arr, n__);\
+  } while (0)
+
+
+#define vecl_extend(v, v2)\
+  vecl_pusharr((v), (v2)->data, (v2)->length)
+
+
+#define vecl_find(v, val, idx)\
+  do {\
+    for ((idx) = 0; (idx) < (v)->length; (idx)++) {\
+      if ((v)->data[(idx)] == (val)) break;\
+    }\
+    if ((idx) == (v)->length) (idx) = VECL_NPOS;\
+  } while (0)
+
+
+#define vecl_remove(v, val)\
+  do {\
+    size_t idx__;\
+    vecl_find(v, val, idx__);\
+    if (idx__ != VECL_NPOS) vecl_splice(v, idx__, 1);\
+  } while (0)
+
+
+#define vecl_reverse(v)\
+  do {\
+    size_t i__ = (v)->length / 2;\
+    while (i__--) {\
+      vecl_swap((v), i__, (v)->length - (i__ + 1));\
+    }\
+  } while (0)
+
+
+#define vecl_foreach_rev(v, var, iter)\
+  for ( (iter) = (v)->length;\
+        (iter)-- > 0 && (((var) = (v)->data[(iter)]), 1);\
+        )
+
+
+#define vecl_foreach_ptr_rev(v, var, iter)\
+  for ( (iter) = (v)->length;\
+        (iter)-- > 0 && (((var) = &(v)->data[(iter)]), 1);\
+        )
+
+
+
+int vecl_expand_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 vec_alloc_fn fn, void *ud);
+int vecl_grow_(char **data, size_t *length, size_t *capacity, size_t memsz,
+               vec_alloc_fn fn, void *ud, size_t n);
+int vecl_reserve_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                  vec_alloc_fn fn, void *ud, size_t n);
+int vecl_compact_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                  vec_alloc_fn fn, void *ud);
+int vecl_insert_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 vec_alloc_fn fn, void *ud, size_t idx);
+void vecl_free_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                vec_alloc_fn fn, void *ud);
+void vecl_splice_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                  size_t start, size_t count);
+void vecl_swapsplice_(char **data, size_t *length, size_t *capacity,
+                      size_t memsz, size_t start, size_t count);
+void vecl_swap_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                size_t idx1, size_t idx2);
+
+
+typedef vecl_t(void*) vecl_void_t;
+typedef vecl_t(char*) vecl_str_t;
+typedef vecl_t(int) vecl_int_t;
+typedef vecl_t(char) vecl_char_t;
+typedef vecl_t(float) vecl_float_t;
+typedef vecl_t(double) vecl_double_t;
+
+#ifdef __GNUC__
+
+/* vecc_t: a vec that many threads can vecc_push to at once without a lock.
+ * Each push reserves an index with an atomic increment and writes into
+ * segmented storage that never moves (segment k holds VECC_BASE << k
+ * elements), then publishes the slot. Readers may run concurrently and only
+ * see published elements: vecc_get fails and vecc_foreach skips slots whose
+ * push is still in flight. If a segment can't be allocated the push is
+ * dropped and its slot is never published. vecc_init and vecc_deinit must
+ * not race with other operations. */
+
+#define VECC_BASE_SHIFT 6
+#define VECC_BASE       ((size_t) 1 << VECC_BASE_SHIFT)
+#define VECC_SEGMENTS   ((int) sizeof(size_t) * 8 - VECC_BASE_SHIFT)
+
+
+#define vecc_unpack_(v)\
+  (char**)(v)->seg, &(v)->length, sizeof(**(v)->seg)
+
+
+#define vecc_t(T)\
+  struct { T *seg[VECC_SEGMENTS]; size_t length; }
+
+
+#define vecc_seg_(i)\
+  (63 - __builtin_clzll((unsigned long long) (i) + VECC_BASE) -\
+   VECC_BASE_SHIFT)
+
+
+#define vecc_off_(i)\
+  ((i) + VECC_BASE - (VECC_BASE << vecc_seg_(i)))
+
+
+#define vecc_at_(v, i)\
+  __atomic_load_n(&(v)->seg[vecc_seg_(i)], __ATOMIC_ACQUIRE)[vecc_off_(i)]
+
+
+#define vecc_init(v)\
+  memset((v), 0, sizeof(*(v)))
+
+
+#define vecc_deinit(v)\
+  ( vecc_deinit_(vecc_unpack_(v)), vecc_init(v) )
+
+
+/* number of reserved slots; published ones are a subset of [0, length) */
+#define vecc_length(v)\
+  __atomic_load_n(&(v)->length, __ATOMIC_ACQUIRE)
+
+
+#define vecc_push(v, val)\
+  do {\
+    size_t i__ = vecc_claim_(vecc_unpack_(v));\
+    if (i__ == (size_t) -1) break;\
+    vecc_at_(v, i__) = (val);\
+    vecc_publish_(vecc_unpack_(v), i__);\
+  } while (0)
+
+
+#define vecc_get(v, idx, var)\
+  ( vecc_ready_(vecc_unpack_(v), idx) ? ((var) = vecc_at_(v, idx), 1) : 0 )
+
+
+#define vecc_foreach(v, var, iter)\
+  for ( (iter) = 0; (iter) < vecc_length(v); ++(iter))\
+    if (vecc_get(v, iter, var))
+
+
+
+size_t vecc_claim_(char **seg, size_t *length, size_t memsz);
+void vecc_publish_(char **seg, size_t *length, size_t memsz, size_t idx);
+int vecc_ready_(char **seg, size_t *length, size_t memsz, size_t idx);
+void vecc_deinit_(char **seg, size_t *length, size_t memsz);
+
+#endif
+
 #endif
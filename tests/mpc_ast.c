@@ -0,0 +1,83 @@
+/*====================================================
+ * MPC AST
+ *
+ * checks that nodes added to a tree in an arena are
+ * moved in without their pointers going stale. run
+ * by build.sh:
+ *
+ *   mpc_ast
+ *====================================================*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mpc/mpc.h"
+
+static int failures = 0;
+
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #x); failures++; } \
+  } while (0)
+
+static mpc_ast_t *parse(mpc_parser_t *p, const char *s) {
+  mpc_result_t r;
+  if (!mpc_parse("<test>", s, p, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return NULL;
+  }
+  return r.output;
+}
+
+int main(void) {
+
+  mpc_parser_t *Word = mpc_new("word");
+  mpc_parser_t *Words = mpc_new("words");
+  mpc_ast_t *root, *other, *c, *d;
+
+  mpca_lang(MPCA_LANG_AST_ARENA,
+    "word  : /[a-z]+/ ;"
+    "words : /^/ <word>+ /$/ ;",
+    Word, Words, NULL);
+
+  root = parse(Words, "ab cd");
+  other = parse(Words, "ef");
+  CHECK(root && other && root->arena && other->arena != root->arena);
+  if (!root || !other) { return 1; }
+
+  /* a heap node keeps its address */
+  c = mpc_ast_new("extra", "x");
+  mpc_ast_add_child(root, c);
+  CHECK(root->children[root->children_num - 1] == c);
+  CHECK(strcmp(c->tag, "extra") == 0);
+  CHECK(strcmp(c->contents, "x") == 0);
+  CHECK(c->arena == root->arena);
+  CHECK(c->tag_id == mpc_ast_tag_id(root, "extra"));
+
+  /* and so do its children */
+  d = mpc_ast_new("inner", "y");
+  mpc_ast_add_child(root, mpc_ast_build(1, "outer", d));
+  CHECK(strcmp(d->tag, "inner") == 0);
+  CHECK(strcmp(d->contents, "y") == 0);
+  CHECK(mpc_ast_get_child(root, "outer")->children[0] == d);
+
+  /* the root of another arena's tree is kept along with its arena */
+  mpc_ast_add_child(root, other);
+  CHECK(root->children[root->children_num - 1] == other);
+  CHECK(other->arena == root->arena);
+  CHECK(strcmp(other->children[1]->contents, "ef") == 0);
+  CHECK(other->children[1]->tag_id == mpc_ast_tag_id(root, other->children[1]->tag));
+
+  /* none of them are freed apart from the tree */
+  mpc_ast_delete(c);
+  mpc_ast_delete(other);
+  CHECK(strcmp(c->tag, "extra") == 0);
+  CHECK(strcmp(other->children[1]->contents, "ef") == 0);
+
+  mpc_ast_delete(root);
+  mpc_cleanup(2, Word, Words);
+
+  if (failures) { fprintf(stderr, "%d failed\n", failures); return 1; }
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,377 @@
+/*====================================================
+ * REPLAY
+ *
+ * re-executes a dmt allocation trace against an allocator and reports
+ * throughput and footprint:
+ *
+ *   replay <trace> [glibc|arena|pool]
+ *====================================================*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "dmt/dmt.h"
+#include "vec/vec.h"
+#include "arena/arena.h"
+
+#define POOL_MIN_SHIFT 4    /* smallest size class is 16 bytes */
+#define POOL_CLASSES   9    /* largest size class is 4096 bytes */
+#define POOL_SLAB_SIZE 65536
+
+typedef struct { int kind; unsigned long long id; size_t size; } Event;
+typedef struct { void *ptr; size_t size; } Slot;
+typedef vec_t(Event) vec_event_t;
+typedef vec_t(Slot) vec_slot_t;
+
+/* realloc-like allocator that is also told the block's old size. counted,
+ * if set, is used instead of realloc while the footprint is sampled, for
+ * allocators that need extra bookkeeping to report it */
+typedef struct {
+  const char *name;
+  void *(*realloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+  void *(*counted)(void *ud, void *ptr, size_t osize, size_t nsize);
+  size_t (*footprint)(void *ud);
+} Allocator;
+
+/*====================================================
+ * GLIBC
+ *====================================================*/
+
+static size_t glibc_live;
+
+static void *glibc_realloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void) ud;
+  (void) osize;
+  if (nsize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsize);
+}
+
+/* glibc_realloc that also keeps glibc_live, for glibc_footprint */
+static void *glibc_counted(void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void) osize;
+#ifdef __GLIBC__
+  if (ptr) glibc_live -= malloc_usable_size(ptr);
+#else
+  if (ptr) glibc_live -= osize;
+#endif
+  ptr = glibc_realloc(ud, ptr, osize, nsize);
+#ifdef __GLIBC__
+  if (ptr) glibc_live += malloc_usable_size(ptr);
+#else
+  if (ptr) glibc_live += nsize;
+#endif
+  return ptr;
+}
+
+static size_t glibc_footprint(void *ud) {
+  (void) ud;
+  return glibc_live;
+}
+
+/*====================================================
+ * ARENA
+ *====================================================*/
+
+static void *arena_realloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void) osize;
+  return alloc_arena(ud, ptr, nsize);
+}
+
+static size_t arena_footprint(void *ud) {
+  Arena *A = ud;
+  static ArenaBlock *last;
+  static size_t reserved;
+  /* blocks are only ever pushed to the front, so only the head can be new */
+  if (A->blocks != last) {
+    reserved = arena_reserved(A);
+    last = A->blocks;
+  }
+  return reserved;
+}
+
+/*====================================================
+ * SIZE-CLASS POOL
+ *====================================================*/
+
+typedef struct PoolFree PoolFree;
+struct PoolFree { PoolFree *next; };
+
+typedef struct {
+  PoolFree *free[POOL_CLASSES];
+  vec_void_t slabs;
+  size_t reserved;
+} Pool;
+
+static int pool_class(size_t size) {
+  int c = 0;
+  size_t n = (size_t) 1 << POOL_MIN_SHIFT;
+  while (n < size) {
+    n <<= 1;
+    c++;
+  }
+  return c < POOL_CLASSES ? c : -1;
+}
+
+static void *pool_alloc(Pool *P, size_t size) {
+  int c = pool_class(size);
+  PoolFree *f;
+  if (c < 0) {
+    P->reserved += size;
+    return malloc(size);
+  }
+  if (!P->free[c]) {
+    /* carve a fresh slab into blocks of this class */
+    size_t bsize = (size_t) 1 << (c + POOL_MIN_SHIFT), i;
+    char *slab = malloc(POOL_SLAB_SIZE);
+    if (!slab) return NULL;
+    if (vec_push(&P->slabs, slab) != 0) {
+      free(slab);
+      return NULL;
+    }
+    P->reserved += POOL_SLAB_SIZE;
+    for (i = 0; i + bsize <= POOL_SLAB_SIZE; i += bsize) {
+      f = (PoolFree*) (slab + i);
+      f->next = P->free[c];
+      P->free[c] = f;
+    }
+  }
+  f = P->free[c];
+  P->free[c] = f->next;
+  return f;
+}
+
+static void pool_free(Pool *P, void *ptr, size_t size) {
+  int c = pool_class(size);
+  PoolFree *f = ptr;
+  if (c < 0) {
+    P->reserved -= size;
+    free(ptr);
+    return;
+  }
+  f->next = P->free[c];
+  P->free[c] = f;
+}
+
+static void *pool_realloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *P = ud;
+  void *p;
+  if (ptr && nsize > 0 && pool_class(osize) >= 0 &&
+      pool_class(osize) == pool_class(nsize)) {
+    return ptr;
+  }
+  p = nsize > 0 ? pool_alloc(P, nsize) : NULL;
+  if (ptr) {
+    if (p) memcpy(p, ptr, osize < nsize ? osize : nsize);
+    pool_free(P, ptr, osize);
+  }
+  return p;
+}
+
+static size_t pool_footprint(void *ud) {
+  return ((Pool*) ud)->reserved;
+}
+
+static void pool_deinit(Pool *P) {
+  int i;
+  void *slab;
+  vec_foreach(&P->slabs, slab, i) free(slab);
+  vec_deinit(&P->slabs);
+}
+
+/*====================================================
+ * REPLAY
+ *====================================================*/
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int load(const char *filename, vec_event_t *events) {
+  FILE *fp = fopen(filename, "rb");
+  dmt_reader_t r;
+  dmt_event_t ev;
+  int res = 0;
+  if (!fp) {
+    fprintf(stderr, "could not open '%s'\n", filename);
+    return -1;
+  }
+  dmt_reader_init(&r, fp);
+  while ((res = dmt_trace_read(&r, &ev)) > 0) {
+    Event e;
+    if (ev.kind == DMT_TRACE_HEADER || ev.kind == DMT_TRACE_SITE) continue;
+    e.kind = ev.kind;
+    e.id = ev.id;
+    e.size = ev.size;
+    if (vec_push(events, e) != 0) res = -1;
+  }
+  if (res < 0) fprintf(stderr, "malformed trace '%s'\n", filename);
+  dmt_reader_deinit(&r);
+  fclose(fp);
+  return res;
+}
+
+/* replays every event once, with all slots empty to begin with. The
+ * footprint is only sampled when peak_foot is given, so that a timed replay
+ * measures the allocator calls alone */
+static int replay(const Allocator *a, void *ud, vec_event_t *events,
+                  vec_slot_t *slots, unsigned long long base,
+                  size_t *peak, size_t *peak_foot) {
+  void *(*fn)(void*, void*, size_t, size_t) = a->realloc;
+  size_t live = 0, foot;
+  int i;
+  if (peak_foot && a->counted) fn = a->counted;
+  for (i = 0; i < events->length; i++) {
+    Event *e = &events->data[i];
+    Slot *s;
+    if (e->id < base) continue;
+    s = &slots->data[e->id - base];
+    if (e->kind == DMT_TRACE_FREE) {
+      if (!s->ptr) continue;
+      fn(ud, s->ptr, s->size, 0);
+      live -= s->size;
+      s->ptr = NULL;
+      s->size = 0;
+      continue;
+    }
+    s->ptr = fn(ud, s->ptr, s->size, e->size);
+    if (!s->ptr && e->size) {
+      fprintf(stderr, "out of memory replaying event %d\n", i);
+      return -1;
+    }
+    if (s->ptr) *(char*) s->ptr = 0;
+    live += e->size - s->size;
+    s->size = e->size;
+    if (!peak_foot) continue;
+    if (live > *peak) *peak = live;
+    foot = a->footprint(ud);
+    if (foot > *peak_foot) *peak_foot = foot;
+  }
+  return 0;
+}
+
+/* frees the blocks still live after a replay, unless the allocator
+ * reclaims them all at once, and empties the slots */
+static void release(const Allocator *a, void *ud, vec_slot_t *slots,
+                    int free_blocks) {
+  int i;
+  for (i = 0; i < slots->length; i++) {
+    if (slots->data[i].ptr && free_blocks) {
+      a->realloc(ud, slots->data[i].ptr, slots->data[i].size, 0);
+    }
+  }
+  memset(slots->data, 0, slots->length * sizeof(*slots->data));
+}
+
+int main(int argc, char **argv) {
+  vec_event_t events;
+  vec_slot_t slots;
+  Allocator a;
+  Arena arena;
+  Pool pool;
+  void *ud;
+  unsigned long long base = (unsigned long long) -1, top = 0;
+  size_t peak = 0, peak_foot = 0;
+  double t;
+  int i;
+  const char *name = argc > 2 ? argv[2] : "glibc";
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <trace> [glibc|arena|pool]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  arena_init(&arena);
+  if (!strcmp(name, "glibc")) {
+    a.realloc = glibc_realloc;
+    a.counted = glibc_counted;
+    a.footprint = glibc_footprint;
+    ud = NULL;
+  } else if (!strcmp(name, "arena")) {
+    a.realloc = arena_realloc;
+    a.counted = NULL;
+    a.footprint = arena_footprint;
+    ud = &arena;
+  } else if (!strcmp(name, "pool")) {
+    a.realloc = pool_realloc;
+    a.counted = NULL;
+    a.footprint = pool_footprint;
+    ud = &pool;
+  } else {
+    fprintf(stderr, "unknown allocator '%s'\n", name);
+    return EXIT_FAILURE;
+  }
+  a.name = name;
+
+  vec_init(&events);
+  vec_init(&slots);
+  if (load(argv[1], &events) < 0) return EXIT_FAILURE;
+
+  /* block ids are sequential, so map them to slots by offset from the
+   * lowest id; blocks allocated before tracing began are ignored */
+  for (i = 0; i < events.length; i++) {
+    if (events.data[i].kind == DMT_TRACE_ALLOC && events.data[i].id < base) {
+      base = events.data[i].id;
+    }
+    if (events.data[i].id > top) top = events.data[i].id;
+  }
+  if (base <= top) {
+    int n;
+    if (top - base >= INT_MAX) {
+      fprintf(stderr, "trace spans too many blocks\n");
+      return EXIT_FAILURE;
+    }
+    n = (int) (top - base + 1);
+    if (vec_reserve(&slots, n) != 0) return EXIT_FAILURE;
+    memset(slots.data, 0, n * sizeof(*slots.data));
+    slots.length = n;
+  }
+
+  /* the footprint is measured in a pass of its own, then the allocator is
+   * reset and the trace replayed again with only the allocator calls timed */
+  if (replay(&a, ud, &events, &slots, base, &peak, &peak_foot) < 0) {
+    return EXIT_FAILURE;
+  }
+  release(&a, ud, &slots, ud != &arena);
+  arena_deinit(&arena);
+  arena_init(&arena);
+  pool_deinit(&pool);
+  memset(&pool, 0, sizeof(pool));
+  glibc_live = 0;
+
+  t = now();
+  if (replay(&a, ud, &events, &slots, base, NULL, NULL) < 0) {
+    return EXIT_FAILURE;
+  }
+  t = now() - t;
+
+  printf("allocator:      %s\n", a.name);
+  printf("events:         %d\n", events.length);
+  printf("time:           %.6f s (%.1f ns/event)\n", t,
+         events.length ? t * 1e9 / events.length : 0.0);
+  printf("peak requested: %lu bytes\n", (unsigned long) peak);
+  printf("peak footprint: %lu bytes (%.2fx)\n", (unsigned long) peak_foot,
+         peak ? (double) peak_foot / peak : 0.0);
+
+  release(&a, ud, &slots, ud != &arena);
+  arena_deinit(&arena);
+  pool_deinit(&pool);
+  vec_deinit(&slots);
+  vec_deinit(&events);
+  return EXIT_SUCCESS;
+}